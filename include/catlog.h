@@ -1,16 +1,71 @@
 #ifndef CATLOG_H
 #define CATLOG_H
 
+#include <stddef.h>
 #include <stdint.h>
+#include "catlog_proto.h"
 
+// stored as-is in ur0:/data/catlog.cfg, new fields must be appended at the end
 typedef struct {
     uint32_t host;
     uint16_t port;
     uint16_t loglevel;
     uint8_t net;
+    uint8_t format; // CATLOG_FORMAT_*
+    uint16_t batch_bytes; // send threshold while the ring is filling up, 0 = default
+    uint16_t flush_ms;    // longest a record waits for its batch, 0 = default
+    uint8_t net_priority; // base priority of the network thread, 0 = default
+    uint8_t net_affinity; // bit n allows the network thread on core n, 0 = any core
+    uint8_t min_level;    // records below this CATLOG_LEVEL_* are dropped
+    uint8_t sources;      // bit per CATLOG_SOURCE_* to keep, 0 = all
+    uint8_t caller;       // record the caller's address in each record, see CatLogCaller_t
+    uint16_t metrics_ms;  // CATLOG_RECORD_METRICS sampling interval, 0 = off
 } CatLogConfig_t;
 
 int CatLogReadConfig(uint32_t* host, uint16_t* port, uint16_t* level, uint8_t* net);
 int CatLogUpdateConfig(uint32_t host, uint16_t port, uint16_t level, uint8_t net);
 
+int CatLogGetConfig(CatLogConfig_t* cfg);
+int CatLogSetConfig(const CatLogConfig_t* cfg);
+
+// Queues buf as text records of the given CATLOG_LEVEL_* with a single syscall.
+// Returns the number of bytes queued or a negative error.
+int CatLogWrite(const char* buf, size_t len, int level);
+
+// Timeline events for catlog-trace, one fixed-size CATLOG_RECORD_TRACE record each.
+// The name is copied, up to CATLOG_TRACE_NAME_LEN bytes. Traces are only sent with the framed stream format.
+int CatLogTrace(int phase, const char* name, int64_t value);
+int CatLogTraceForDriver(int phase, const char* name, int64_t value);
+
+#ifdef CATLOG_KERNEL
+#define CATLOG_TRACE CatLogTraceForDriver
+#else
+#define CATLOG_TRACE CatLogTrace
+#endif
+
+#define CatLogTraceBegin(name) CATLOG_TRACE(CATLOG_TRACE_BEGIN, (name), 0)
+#define CatLogTraceEnd(name) CATLOG_TRACE(CATLOG_TRACE_END, (name), 0)
+#define CatLogTraceCounter(name, value) CATLOG_TRACE(CATLOG_TRACE_COUNTER, (name), (value))
+#define CatLogTraceInstant(name) CATLOG_TRACE(CATLOG_TRACE_INSTANT, (name), 0)
+
+// Shared log channel, see catlog_channel.h for the writer side.
+// The header page is followed by `size` (power of two) bytes of record data at CATLOG_CHANNEL_DATA_OFFSET.
+// Records are 4-byte aligned, a record becomes visible to the kernel once its magic is stored.
+#define CATLOG_CHANNEL_DATA_OFFSET 0x1000
+#define CATLOG_CHANNEL_MIN_SIZE 0x4000
+#define CATLOG_CHANNEL_MAX_SIZE 0x100000
+#define CATLOG_CHANNEL_MAX_PAYLOAD 0x1000
+
+typedef struct {
+    uint32_t size;
+    volatile uint32_t reserve; // bytes reserved by writers, free running
+    volatile uint32_t tail;    // bytes consumed by the kernel, free running
+    volatile uint32_t dropped; // records that didn't fit
+} CatLogChannel_t;
+
+// Maps a channel with at least `size` bytes of data into the calling process, one per process.
+// It's unmapped by CatLogCloseChannel or when the process exits.
+int CatLogOpenChannel(size_t size, CatLogChannel_t** channel);
+int CatLogCloseChannel(void);
+
 #endif // CATLOG_H
\ No newline at end of file
@@ -0,0 +1,82 @@
+#ifndef CATLOG_CHANNEL_H
+#define CATLOG_CHANNEL_H
+
+// Userland writer for a channel opened with CatLogOpenChannel, no syscalls involved.
+
+#include "catlog.h"
+
+#include <psp2/kernel/threadmgr.h>
+
+#define CATLOG_CHANNEL_ALIGN(x) (((x) + 3) & ~3u)
+
+static inline char* CatLogChannelData(CatLogChannel_t* ch)
+{
+    return (char*)ch + CATLOG_CHANNEL_DATA_OFFSET;
+}
+
+static inline void CatLogChannelCopy(CatLogChannel_t* ch, uint32_t pos, const void* src, uint32_t len)
+{
+    uint32_t off   = pos & (ch->size - 1);
+    uint32_t first = ch->size - off;
+    if (first > len)
+        first = len;
+    __builtin_memcpy(CatLogChannelData(ch) + off, src, first);
+    __builtin_memcpy(CatLogChannelData(ch), (const char*)src + first, len - first);
+}
+
+// Queues one record, returns 0 or -1 if the channel is full.
+static inline int CatLogChannelWriteRecord(CatLogChannel_t* ch, int type, int level, const void* buf, uint32_t len)
+{
+    uint32_t total = CATLOG_CHANNEL_ALIGN(sizeof(CatLogRecord_t) + len);
+    uint32_t pos   = __atomic_load_n(&ch->reserve, __ATOMIC_RELAXED);
+
+    if (len > CATLOG_CHANNEL_MAX_PAYLOAD)
+        return -1;
+
+    do
+    {
+        uint32_t tail = __atomic_load_n(&ch->tail, __ATOMIC_ACQUIRE);
+        if (pos + total - tail > ch->size)
+        {
+            __atomic_fetch_add(&ch->dropped, 1, __ATOMIC_RELAXED);
+            return -1;
+        }
+    } while (!__atomic_compare_exchange_n(&ch->reserve, &pos, pos + total, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    CatLogRecord_t rec;
+    rec.magic = 0;
+    rec.type  = type;
+    rec.level = level;
+    rec.flags = CATLOG_SOURCE_USER;
+    rec.cpu   = 0;
+    rec.size  = len;
+    rec.pid   = 0; // filled in by the kernel
+    rec.thid  = sceKernelGetThreadId();
+    rec.time  = sceKernelGetSystemTimeWide();
+
+    // everything but the magic first, the magic publishes the record
+    CatLogChannelCopy(ch, pos + 2, (const char*)&rec + 2, sizeof(rec) - 2);
+    CatLogChannelCopy(ch, pos + sizeof(rec), buf, len);
+    __atomic_store_n((uint16_t*)(CatLogChannelData(ch) + (pos & (ch->size - 1))), CATLOG_RECORD_MAGIC,
+                     __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+static inline int CatLogChannelWrite(CatLogChannel_t* ch, const char* buf, size_t len, int level)
+{
+    return CatLogChannelWriteRecord(ch, CATLOG_RECORD_TEXT, level, buf, len);
+}
+
+// same as CatLogTrace without the syscall
+static inline int CatLogChannelTrace(CatLogChannel_t* ch, int phase, const char* name, int64_t value)
+{
+    CatLogTrace_t trace = {0};
+    trace.phase = phase;
+    trace.value = value;
+    for (int i = 0; name && i < CATLOG_TRACE_NAME_LEN && name[i]; i++)
+        trace.name[i] = name[i];
+    return CatLogChannelWriteRecord(ch, CATLOG_RECORD_TRACE, CATLOG_LEVEL_INFO, &trace, sizeof(trace));
+}
+
+#endif // CATLOG_CHANNEL_H
@@ -0,0 +1,157 @@
+#ifndef CATLOG_EVENT_H
+#define CATLOG_EVENT_H
+
+// Structured events: typed key/value pairs encoded as a binary CATLOG_RECORD_EVENT payload.
+//
+//   CatLogEvent("frame", CATLOG_U32("index", n), CATLOG_F32("ms", dt), CATLOG_STR("scene", name));
+//
+// Payload layout: u8 name_len, name, then per field u8 type, u8 key_len, key, value.
+// Integer and float values are stored little-endian in their natural width,
+// CATLOG_FIELD_STR values as u16 length followed by the bytes.
+// Kernel code has to define CATLOG_KERNEL before including this header.
+
+#include "catlog.h"
+
+#define CATLOG_FIELD_I32 1
+#define CATLOG_FIELD_I64 2
+#define CATLOG_FIELD_U32 3
+#define CATLOG_FIELD_U64 4
+#define CATLOG_FIELD_F32 5
+#define CATLOG_FIELD_F64 6
+#define CATLOG_FIELD_BOOL 7
+#define CATLOG_FIELD_STR 8
+
+#define CATLOG_EVENT_MAX 0x200
+
+typedef struct {
+    const char* key;
+    uint8_t type;
+    union {
+        int64_t i;
+        uint64_t u;
+        float f32;
+        double f64;
+        const char* s;
+    } v;
+} CatLogField_t;
+
+#define CATLOG_I32(k, x) ((CatLogField_t){.key = (k), .type = CATLOG_FIELD_I32, .v.i = (int32_t)(x)})
+#define CATLOG_I64(k, x) ((CatLogField_t){.key = (k), .type = CATLOG_FIELD_I64, .v.i = (int64_t)(x)})
+#define CATLOG_U32(k, x) ((CatLogField_t){.key = (k), .type = CATLOG_FIELD_U32, .v.u = (uint32_t)(x)})
+#define CATLOG_U64(k, x) ((CatLogField_t){.key = (k), .type = CATLOG_FIELD_U64, .v.u = (uint64_t)(x)})
+#define CATLOG_F32(k, x) ((CatLogField_t){.key = (k), .type = CATLOG_FIELD_F32, .v.f32 = (x)})
+#define CATLOG_F64(k, x) ((CatLogField_t){.key = (k), .type = CATLOG_FIELD_F64, .v.f64 = (x)})
+#define CATLOG_BOOL(k, x) ((CatLogField_t){.key = (k), .type = CATLOG_FIELD_BOOL, .v.u = !!(x)})
+#define CATLOG_STR(k, x) ((CatLogField_t){.key = (k), .type = CATLOG_FIELD_STR, .v.s = (x)})
+
+// queues an already encoded event payload
+int CatLogWriteEvent(const void* buf, size_t len, int level);
+int CatLogWriteEventForDriver(const void* buf, size_t len, int level);
+
+#ifdef CATLOG_KERNEL
+#define CATLOG_WRITE_EVENT CatLogWriteEventForDriver
+#else
+#define CATLOG_WRITE_EVENT CatLogWriteEvent
+#endif
+
+static inline int CatLogEventPut(char* buf, int* off, int size, const void* src, int len)
+{
+    if (*off + len > size)
+        return -1;
+    __builtin_memcpy(buf + *off, src, len);
+    *off += len;
+    return 0;
+}
+
+// length prefixed string, the prefix is u16 when max doesn't fit into a byte
+static inline int CatLogEventPutStr(char* buf, int* off, int size, const char* s, int max)
+{
+    int len = 0;
+    while (s && len < max && s[len])
+        len++;
+    if (max > 0xFF)
+    {
+        uint16_t len16 = len;
+        if (CatLogEventPut(buf, off, size, &len16, sizeof(len16)) < 0)
+            return -1;
+    }
+    else
+    {
+        uint8_t len8 = len;
+        if (CatLogEventPut(buf, off, size, &len8, sizeof(len8)) < 0)
+            return -1;
+    }
+    return CatLogEventPut(buf, off, size, s, len);
+}
+
+// Returns the encoded size or -1 if it doesn't fit.
+static inline int CatLogEventEncode(char* buf, int size, const char* name, const CatLogField_t* fields, int count)
+{
+    int off = 0;
+
+    if (CatLogEventPutStr(buf, &off, size, name, 0xFF) < 0)
+        return -1;
+
+    for (int i = 0; i < count; i++)
+    {
+        const CatLogField_t* f = &fields[i];
+        int width;
+
+        switch (f->type)
+        {
+        case CATLOG_FIELD_I32:
+        case CATLOG_FIELD_U32:
+        case CATLOG_FIELD_F32:
+            width = 4;
+            break;
+        case CATLOG_FIELD_I64:
+        case CATLOG_FIELD_U64:
+        case CATLOG_FIELD_F64:
+            width = 8;
+            break;
+        case CATLOG_FIELD_BOOL:
+            width = 1;
+            break;
+        case CATLOG_FIELD_STR:
+            width = 0;
+            break;
+        default:
+            return -1;
+        }
+
+        if (CatLogEventPut(buf, &off, size, &f->type, 1) < 0 || CatLogEventPutStr(buf, &off, size, f->key, 0xFF) < 0)
+            return -1;
+
+        if (f->type == CATLOG_FIELD_STR)
+        {
+            if (CatLogEventPutStr(buf, &off, size, f->v.s, CATLOG_EVENT_MAX) < 0)
+                return -1;
+        }
+        // little-endian, the low `width` bytes of the union hold the value
+        else if (CatLogEventPut(buf, &off, size, &f->v, width) < 0)
+        {
+            return -1;
+        }
+    }
+
+    return off;
+}
+
+static inline int CatLogEventFields(int level, const char* name, const CatLogField_t* fields, int count)
+{
+    char buf[CATLOG_EVENT_MAX];
+    int len = CatLogEventEncode(buf, sizeof(buf), name, fields, count);
+    if (len < 0)
+        return len;
+    return CATLOG_WRITE_EVENT(buf, len, level);
+}
+
+#define CATLOG_FIELDS(...) ((const CatLogField_t[]){__VA_ARGS__})
+#define CATLOG_FIELD_COUNT(...) (sizeof(CATLOG_FIELDS(__VA_ARGS__)) / sizeof(CatLogField_t))
+
+#define CatLogEvent(name, ...) \
+    CatLogEventFields(CATLOG_LEVEL_INFO, (name), CATLOG_FIELDS(__VA_ARGS__), CATLOG_FIELD_COUNT(__VA_ARGS__))
+#define CatLogEventLevel(level, name, ...) \
+    CatLogEventFields((level), (name), CATLOG_FIELDS(__VA_ARGS__), CATLOG_FIELD_COUNT(__VA_ARGS__))
+
+#endif // CATLOG_EVENT_H
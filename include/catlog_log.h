@@ -0,0 +1,114 @@
+#ifndef CATLOG_LOG_H
+#define CATLOG_LOG_H
+
+// Leveled printf-style logging for userland, header only.
+//
+//   CatLogInfof("loaded %s in %d ms", path, ms);
+//
+// Statements below CATLOG_MIN_LEVEL are compiled out, the format is still checked.
+// The others compare against the kernel's minimum severity, read once with CatLogGetConfig
+// (CatLogLogRefresh reads it again), so filtered statements cost no syscall and no formatting.
+// Messages are queued with CatLogWrite, a newline is added if missing. Linked against
+// CatLog_stub_weak without CatLog running, they go to sceClibPrintf instead.
+
+#include "catlog.h"
+
+#include <psp2/kernel/clib.h>
+#include <stdarg.h>
+
+#ifndef CATLOG_MIN_LEVEL
+#ifdef NDEBUG
+#define CATLOG_MIN_LEVEL CATLOG_LEVEL_INFO
+#else
+#define CATLOG_MIN_LEVEL CATLOG_LEVEL_TRACE
+#endif
+#endif
+
+#define CATLOG_LOG_LINE_LEN 0x200
+
+#define CATLOG_LOG_UNKNOWN -1
+#define CATLOG_LOG_OFF (CATLOG_LEVEL_FATAL + 1)
+
+// shared by all translation units of the program
+__attribute__((weak)) int CatLogLogMinLevel = CATLOG_LOG_UNKNOWN;
+__attribute__((weak)) int CatLogLogFallback = 0;
+
+__attribute__((noinline, cold, unused)) static int CatLogLogRefresh(void)
+{
+    CatLogConfig_t cfg;
+    int level = CATLOG_LEVEL_TRACE;
+
+    if (CatLogGetConfig(&cfg) < 0)
+    {
+        CatLogLogFallback = 1;
+    }
+    else
+    {
+        CatLogLogFallback = 0;
+        level             = cfg.min_level;
+        if (cfg.sources && !(cfg.sources & (1 << CATLOG_SOURCE_USER)))
+            level = CATLOG_LOG_OFF;
+    }
+
+    CatLogLogMinLevel = level;
+    return level;
+}
+
+static inline int CatLogLogLevel(void)
+{
+    int level = CatLogLogMinLevel;
+    if (__builtin_expect(level == CATLOG_LOG_UNKNOWN, 0))
+        level = CatLogLogRefresh();
+    return level;
+}
+
+// out of line, call sites only pay for the level check and the call
+__attribute__((noinline, unused, format(printf, 2, 0))) static int CatLogVPrintf(int level, const char* fmt, va_list args)
+{
+    char buf[CATLOG_LOG_LINE_LEN];
+    int len = sceClibVsnprintf(buf, sizeof(buf) - 1, fmt, args);
+
+    if (len < 0)
+        return len;
+    if (len > (int)sizeof(buf) - 2)
+        len = sizeof(buf) - 2;
+    if (len == 0 || buf[len - 1] != '\n')
+        buf[len++] = '\n';
+    buf[len] = '\0';
+
+    if (!CatLogLogFallback)
+    {
+        int ret = CatLogWrite(buf, len, level);
+        if (ret >= 0)
+            return ret;
+        CatLogLogFallback = 1;
+    }
+
+    return sceClibPrintf("%s", buf);
+}
+
+__attribute__((format(printf, 2, 3))) static inline int CatLogPrintf(int level, const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int ret = CatLogVPrintf(level, fmt, args);
+    va_end(args);
+    return ret;
+}
+
+// level must be a constant for the compile-time check to drop the statement
+#define CatLogLog(level, ...)                                                         \
+    do                                                                                \
+    {                                                                                 \
+        if ((level) >= CATLOG_MIN_LEVEL && (level) >= CatLogLogLevel())               \
+            CatLogPrintf((level), __VA_ARGS__);                                       \
+    } while (0)
+
+#define CatLogTracef(...) CatLogLog(CATLOG_LEVEL_TRACE, __VA_ARGS__)
+#define CatLogDebugf(...) CatLogLog(CATLOG_LEVEL_DEBUG, __VA_ARGS__)
+#define CatLogInfof(...) CatLogLog(CATLOG_LEVEL_INFO, __VA_ARGS__)
+#define CatLogWarnf(...) CatLogLog(CATLOG_LEVEL_WARN, __VA_ARGS__)
+#define CatLogErrorf(...) CatLogLog(CATLOG_LEVEL_ERROR, __VA_ARGS__)
+#define CatLogFatalf(...) CatLogLog(CATLOG_LEVEL_FATAL, __VA_ARGS__)
+
+#endif // CATLOG_LOG_H
@@ -0,0 +1,164 @@
+#ifndef CATLOG_PROTO_H
+#define CATLOG_PROTO_H
+
+#include <stdint.h>
+
+// Wire format of the framed stream (CATLOG_FORMAT_FRAMED).
+// Everything is little-endian, every record is a CatLogRecord_t followed by `size` payload bytes.
+
+#define CATLOG_PROTO_VERSION 1
+#define CATLOG_RECORD_MAGIC 0xCA71
+
+#define CATLOG_FORMAT_TEXT 0
+#define CATLOG_FORMAT_FRAMED 1
+
+// record types
+#define CATLOG_RECORD_HELLO 0
+#define CATLOG_RECORD_TEXT 1
+#define CATLOG_RECORD_EVENT 2 // see catlog_event.h
+#define CATLOG_RECORD_STATS 3 // CatLogStats_t, answer to CATLOG_CMD_STATS
+#define CATLOG_RECORD_MODULE 4 // CatLogModule_t, precedes the first record with a caller in that module
+#define CATLOG_RECORD_TRACE 5  // CatLogTrace_t
+#define CATLOG_RECORD_METRICS 6 // CatLogMetrics_t
+
+// record flags
+#define CATLOG_FLAG_SOURCE_MASK 0x03
+#define CATLOG_SOURCE_KERNEL 0
+#define CATLOG_SOURCE_USER 1
+#define CATLOG_FLAG_CALLER 0x04 // payload starts with a CatLogCaller_t
+
+// severity of a record
+#define CATLOG_LEVEL_TRACE 0
+#define CATLOG_LEVEL_DEBUG 1
+#define CATLOG_LEVEL_INFO 2
+#define CATLOG_LEVEL_WARN 3
+#define CATLOG_LEVEL_ERROR 4
+#define CATLOG_LEVEL_FATAL 5
+
+typedef struct {
+    uint16_t magic;
+    uint8_t type;
+    uint8_t level;
+    uint8_t flags;
+    uint8_t cpu;
+    uint16_t size;  // payload bytes following the header
+    uint32_t pid;
+    uint32_t thid;
+    uint64_t time;  // system time, microseconds
+} __attribute__((packed)) CatLogRecord_t;
+
+// where a record was logged from
+typedef struct {
+    uint32_t addr;   // return address of the logging call
+    uint32_t modid;  // module containing addr, 0 if it isn't in any module
+    uint32_t offset; // addr relative to the start of the segment
+    uint8_t segment;
+    uint8_t reserved[3];
+} __attribute__((packed)) CatLogCaller_t;
+
+// a module callers refer to, pid is the one of the record header
+typedef struct {
+    uint32_t modid;
+    uint32_t module_nid;
+    uint32_t seg_base[4];
+    uint32_t seg_size[4];
+    char name[28];
+} __attribute__((packed)) CatLogModule_t;
+
+// payload of a record without its caller prefix
+static inline const char* CatLogRecordPayload(const CatLogRecord_t* rec, uint16_t* size)
+{
+    const char* payload = (const char*)(rec + 1);
+    *size = rec->size;
+    if ((rec->flags & CATLOG_FLAG_CALLER) && *size >= sizeof(CatLogCaller_t))
+    {
+        payload += sizeof(CatLogCaller_t);
+        *size -= sizeof(CatLogCaller_t);
+    }
+    return payload;
+}
+
+// trace event phases, the Chrome trace event format's phase characters
+#define CATLOG_TRACE_BEGIN 'B'
+#define CATLOG_TRACE_END 'E'
+#define CATLOG_TRACE_COUNTER 'C'
+#define CATLOG_TRACE_INSTANT 'i'
+
+#define CATLOG_TRACE_NAME_LEN 24
+
+// Fixed-size timeline event, thread, cpu and timestamp are the ones of the record header.
+// An END closes the latest open BEGIN of the same thread.
+typedef struct {
+    uint8_t phase;
+    uint8_t reserved[3];
+    int64_t value;                    // CATLOG_TRACE_COUNTER only
+    char name[CATLOG_TRACE_NAME_LEN]; // zero padded, not necessarily terminated
+} __attribute__((packed)) CatLogTrace_t;
+
+// Periodic system sample. Run times are cumulative microseconds, utilization is the
+// difference between two samples. The fixed part is followed by process_count
+// CatLogMetricsProcess_t and thread_count CatLogMetricsThread_t. When more processes
+// are watched than fit into one record they take turns, see the flags.
+#define CATLOG_METRICS_PROCESSES_TRUNCATED 0x01 // only some of processes_watched are in this record
+#define CATLOG_METRICS_THREADS_TRUNCATED 0x02   // not every thread has an entry
+typedef struct {
+    uint32_t free_user;    // ksceKernelGetFreeMemorySize, bytes
+    uint32_t free_cdram;
+    uint32_t free_phycont;
+    uint32_t ring_size;
+    uint32_t ring_used;
+    uint32_t ring_dropped;
+    uint16_t process_count;
+    uint16_t thread_count;
+    uint16_t processes_watched;
+    uint16_t flags; // CATLOG_METRICS_*
+} __attribute__((packed)) CatLogMetrics_t;
+
+typedef struct {
+    uint32_t pid;
+    uint32_t threads;  // all threads of the process, not only the sampled ones
+    uint64_t run_time; // sum over the sampled threads
+} __attribute__((packed)) CatLogMetricsProcess_t;
+
+typedef struct {
+    uint32_t pid;
+    uint32_t thid;
+    uint64_t run_time;
+    char name[24];
+} __attribute__((packed)) CatLogMetricsThread_t;
+
+// first record of every framed connection
+typedef struct {
+    uint32_t version;
+} __attribute__((packed)) CatLogHello_t;
+
+typedef struct {
+    uint32_t ring_size;
+    uint32_t ring_used;
+    uint32_t ring_dropped;    // records clobbered before they were sent
+    uint32_t ring_filtered;   // records rejected by the level / source filter
+    uint32_t channels;        // open shared channels
+    uint32_t channel_dropped; // records that didn't fit into a shared channel
+    uint64_t bytes_sent;
+} __attribute__((packed)) CatLogStats_t;
+
+// Commands the host may send back on a framed connection, each one a CatLogCommand_t.
+// They change the running configuration only, nothing is written to the config file.
+#define CATLOG_COMMAND_MAGIC 0xC7D1
+
+#define CATLOG_CMD_SET_LEVEL 1  // arg: kernel log level, as set in the settings menu (0 - CATLOG_KERNEL_LEVEL_MAX)
+#define CATLOG_CMD_SET_FILTER 2 // arg: minimum CATLOG_LEVEL_* | mask of 1 << CATLOG_SOURCE_* << 8, 0 = all sources
+#define CATLOG_CMD_FLUSH 3      // send everything queued right away
+#define CATLOG_CMD_STATS 4      // answered with a CATLOG_RECORD_STATS record
+#define CATLOG_CMD_RESIZE 5     // arg: ring size in bytes
+
+#define CATLOG_KERNEL_LEVEL_MAX 2 // Default, Debug, Trace
+
+typedef struct {
+    uint16_t magic;
+    uint8_t cmd;
+    uint8_t reserved;
+    uint32_t arg;
+} __attribute__((packed)) CatLogCommand_t;
+
+#endif // CATLOG_PROTO_H
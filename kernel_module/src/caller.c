@@ -0,0 +1,195 @@
+/*
+CatLog
+Copyright (C) 2024 Cat
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "caller.h"
+
+#include <psp2kern/kernel/cpu.h>
+#include <psp2kern/kernel/modulemgr.h>
+#include <psp2kern/kernel/threadmgr.h>
+#include <string.h>
+#include <taihen.h>
+
+#define MODULE_CACHE_LEN 32
+#define MODULE_LIST_LEN 128
+#define PENDING_LEN 64
+#define UNKNOWN_PAGE 0x1000
+
+typedef struct {
+  SceUID pid;
+  SceUID modid; // 0 caches a page that isn't part of any module
+  uintptr_t base[4];
+  SceSize size[4];
+} Module;
+
+static Module modules[MODULE_CACHE_LEN];
+static int module_next;
+
+// only net_thread resolves, too large for its stack
+static SceUID module_list[MODULE_LIST_LEN];
+static SceKernelModuleInfo module_info;
+
+static struct {
+  SceUID thid;
+  uintptr_t addr;
+} pending[PENDING_LEN];
+
+static int find_segment(const Module *m, uintptr_t addr)
+{
+  for (int i = 0; i < 4; i++)
+  {
+    if (addr - m->base[i] < m->size[i])
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static void announce(SceUID pid, const Module *m, CallerModule *msg)
+{
+  tai_module_info_t tai_info;
+
+  memset(msg, 0, sizeof(*msg));
+  msg->rec.magic = CATLOG_RECORD_MAGIC;
+  msg->rec.type  = CATLOG_RECORD_MODULE;
+  msg->rec.level = CATLOG_LEVEL_INFO;
+  msg->rec.flags = pid == KERNEL_PID ? CATLOG_SOURCE_KERNEL : CATLOG_SOURCE_USER;
+  msg->rec.cpu   = ksceKernelCpuId();
+  msg->rec.size  = sizeof(msg->mod);
+  msg->rec.pid   = pid;
+  msg->rec.thid  = ksceKernelGetThreadId();
+  msg->rec.time  = ksceKernelGetSystemTimeWide();
+
+  msg->mod.modid = m->modid;
+  for (int i = 0; i < 4; i++)
+  {
+    msg->mod.seg_base[i] = m->base[i];
+    msg->mod.seg_size[i] = m->size[i];
+  }
+  memcpy(msg->mod.name, module_info.module_name, sizeof(msg->mod.name));
+
+  // the NID identifies a firmware module independent of where it got loaded
+  tai_info.size = sizeof(tai_info);
+  if (taiGetModuleInfoForKernel(pid, module_info.module_name, &tai_info) >= 0)
+  {
+    msg->mod.module_nid = tai_info.module_nid;
+  }
+}
+
+// returns 1 if the module was found, msg then announces it
+static int lookup(SceUID pid, uintptr_t addr, Module *m, CallerModule *msg)
+{
+  SceSize num = MODULE_LIST_LEN;
+
+  memset(m, 0, sizeof(*m));
+  m->pid = pid;
+
+  if (ksceKernelGetModuleList(pid, 0xFF, 1, module_list, &num) >= 0)
+  {
+    for (SceSize i = 0; i < num; i++)
+    {
+      module_info.size = sizeof(module_info);
+      if (ksceKernelGetModuleInfo(pid, module_list[i], &module_info) < 0)
+      {
+        continue;
+      }
+
+      for (int j = 0; j < 4; j++)
+      {
+        m->base[j] = (uintptr_t)module_info.segments[j].vaddr;
+        m->size[j] = module_info.segments[j].memsz;
+      }
+
+      if (find_segment(m, addr) >= 0)
+      {
+        m->modid = module_list[i];
+        announce(pid, m, msg);
+        return 1;
+      }
+    }
+  }
+
+  // remember the miss, otherwise every call from there walks the module list again
+  memset(m->size, 0, sizeof(m->size));
+  m->base[0] = addr & ~(UNKNOWN_PAGE - 1);
+  m->size[0] = UNKNOWN_PAGE;
+  return 0;
+}
+
+int caller_resolve(SceUID pid, uintptr_t addr, CatLogCaller_t *caller, CallerModule *msg)
+{
+  int announced = 0;
+
+  memset(caller, 0, sizeof(*caller));
+  caller->addr = addr;
+
+  Module *m = NULL;
+  int seg   = -1;
+  for (int i = 0; i < MODULE_CACHE_LEN && seg < 0; i++)
+  {
+    if (modules[i].pid == pid)
+    {
+      m   = &modules[i];
+      seg = find_segment(m, addr);
+    }
+  }
+
+  if (seg < 0)
+  {
+    m           = &modules[module_next];
+    module_next = (module_next + 1) % MODULE_CACHE_LEN;
+    announced   = lookup(pid, addr, m, msg);
+    seg         = find_segment(m, addr);
+  }
+
+  if (m->modid)
+  {
+    caller->modid   = m->modid;
+    caller->segment = seg;
+    caller->offset  = addr - m->base[seg];
+  }
+
+  return announced;
+}
+
+void caller_reset(void)
+{
+  memset(modules, 0, sizeof(modules));
+  module_next = 0;
+}
+
+void caller_mark(uintptr_t addr)
+{
+  SceUID thid = ksceKernelGetThreadId();
+  int i       = (thid >> 4) % PENDING_LEN;
+
+  pending[i].thid = thid;
+  pending[i].addr = addr;
+}
+
+uintptr_t caller_take(void)
+{
+  SceUID thid = ksceKernelGetThreadId();
+  int i       = (thid >> 4) % PENDING_LEN;
+
+  if (pending[i].thid != thid)
+  {
+    return 0;
+  }
+  pending[i].thid = 0;
+  return pending[i].addr;
+}
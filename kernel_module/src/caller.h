@@ -0,0 +1,42 @@
+/*
+CatLog
+Copyright (C) 2024 Cat
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef CALLER_H
+#define CALLER_H
+
+#include "catlog_proto.h"
+
+#include <psp2kern/types.h>
+
+typedef struct {
+  CatLogRecord_t rec;
+  CatLogModule_t mod;
+} __attribute__((packed)) CallerModule;
+
+// Fills caller for a return address inside pid. The containing module is looked up once
+// and cached, returns 1 on the first lookup with msg holding the CATLOG_RECORD_MODULE
+// record to send before it. Looking modules up takes modulemgr's locks, so this only runs
+// on net_thread, never on the logging paths.
+int caller_resolve(SceUID pid, uintptr_t addr, CatLogCaller_t *caller, CallerModule *msg);
+// forgets all modules, the next connection gets them announced again
+void caller_reset(void);
+
+// return address of a ksceDebugPrintf call, handed over to the printf callback of the same thread
+void caller_mark(uintptr_t addr);
+uintptr_t caller_take(void);
+
+#endif
@@ -0,0 +1,361 @@
+/*
+CatLog
+Copyright (C) 2024 Cat
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "channel.h"
+#include "catlog.h"
+#include "metrics.h"
+#include "ringbuf.h"
+
+#include <psp2/kernel/error.h>
+#include <psp2kern/kernel/cpu.h>
+#include <psp2kern/kernel/processmgr.h>
+#include <psp2kern/kernel/sysmem.h>
+#include <psp2kern/kernel/threadmgr.h>
+#include <string.h>
+
+#define CHANNEL_MAX 16
+#define CHANNEL_ALIGN(x) (((x) + 3) & ~3u)
+
+typedef struct {
+  SceUID pid;
+  SceUID user_uid;
+  SceUID kernel_uid;
+  CatLogChannel_t *ch; // kernel mirror of the process' block
+  uint32_t data_len;   // the process can write ch->size, only this one is trusted
+} Channel;
+
+static Channel channels[CHANNEL_MAX];
+static int channels_open = 0;
+static SceUID chan_mtx_uid = -1;
+
+// only net_thread drains
+static char drain_buf[CATLOG_CHANNEL_MAX_PAYLOAD];
+
+static char *data(Channel *c)
+{
+  return (char *)c->ch + CATLOG_CHANNEL_DATA_OFFSET;
+}
+
+static void copy_out(Channel *c, uint32_t pos, void *dst, uint32_t len)
+{
+  uint32_t off   = pos & (c->data_len - 1);
+  uint32_t first = c->data_len - off;
+  if (first > len)
+  {
+    first = len;
+  }
+  memcpy(dst, data(c) + off, first);
+  memcpy((char *)dst + first, data(c), len - first);
+}
+
+static void clear(Channel *c, uint32_t pos, uint32_t len)
+{
+  uint32_t off   = pos & (c->data_len - 1);
+  uint32_t first = c->data_len - off;
+  if (first > len)
+  {
+    first = len;
+  }
+  memset(data(c) + off, 0, first);
+  memset(data(c), 0, len - first);
+}
+
+static int record_allowed(const CatLogRecord_t *rec)
+{
+  return rec->type == CATLOG_RECORD_TEXT || rec->type == CATLOG_RECORD_EVENT || rec->type == CATLOG_RECORD_TRACE;
+}
+
+static Channel *find(SceUID pid)
+{
+  for (int i = 0; i < CHANNEL_MAX; i++)
+  {
+    if (channels[i].pid == pid)
+    {
+      return &channels[i];
+    }
+  }
+  return NULL;
+}
+
+static void release(Channel *c)
+{
+  ksceKernelFreeMemBlock(c->kernel_uid);
+  ksceKernelFreeMemBlock(c->user_uid);
+  memset(c, 0, sizeof(*c));
+  channels_open--;
+}
+
+static void drain(Channel *c)
+{
+  CatLogRecord_t rec;
+  // read once, the process may change them while we drain
+  uint32_t tail    = c->ch->tail;
+  uint32_t reserve = c->ch->reserve;
+
+  if (reserve - tail > c->data_len || ((tail | reserve) & 3))
+  {
+    // corrupted header, nothing in the ring can be trusted
+    memset(data(c), 0, c->data_len);
+    tail = reserve;
+  }
+
+  while (tail != reserve)
+  {
+    volatile uint16_t *magic = (volatile uint16_t *)(data(c) + (tail & (c->data_len - 1)));
+    if (*magic != CATLOG_RECORD_MAGIC)
+    {
+      // reserved but not written yet
+      break;
+    }
+    __sync_synchronize();
+
+    copy_out(c, tail, &rec, sizeof(rec));
+    uint32_t len = CHANNEL_ALIGN(sizeof(rec) + rec.size);
+    if (rec.size > CATLOG_CHANNEL_MAX_PAYLOAD || len > reserve - tail)
+    {
+      // garbage from the process, drop everything queued
+      clear(c, tail, reserve - tail);
+      tail = reserve;
+      break;
+    }
+
+    // only what the channel API writes, the header is rebuilt from what the kernel knows
+    if (record_allowed(&rec))
+    {
+      copy_out(c, tail + sizeof(rec), drain_buf, rec.size);
+
+      rec.flags = CATLOG_SOURCE_USER;
+      rec.cpu   = ksceKernelCpuId();
+      rec.pid   = c->pid;
+      rec.time  = ksceKernelGetSystemTimeWide();
+      if (rec.level > CATLOG_LEVEL_FATAL)
+      {
+        rec.level = CATLOG_LEVEL_INFO;
+      }
+      ringbuf_put_clobber(&rec, drain_buf);
+    }
+
+    // uncommitted space has to read as zero
+    clear(c, tail, len);
+    tail += len;
+  }
+
+  __sync_synchronize();
+  c->ch->tail = tail;
+}
+
+int channel_drain(void)
+{
+  if (channels_open == 0)
+  {
+    return 0;
+  }
+
+  ksceKernelLockMutex(chan_mtx_uid, 1, NULL);
+
+  for (int i = 0; i < CHANNEL_MAX; i++)
+  {
+    if (channels[i].pid)
+    {
+      drain(&channels[i]);
+    }
+  }
+
+  ksceKernelUnlockMutex(chan_mtx_uid, 1);
+  return 0;
+}
+
+int channel_count(void)
+{
+  return channels_open;
+}
+
+uint32_t channel_dropped(void)
+{
+  uint32_t n = 0;
+
+  ksceKernelLockMutex(chan_mtx_uid, 1, NULL);
+
+  for (int i = 0; i < CHANNEL_MAX; i++)
+  {
+    if (channels[i].pid)
+    {
+      n += channels[i].ch->dropped;
+    }
+  }
+
+  ksceKernelUnlockMutex(chan_mtx_uid, 1);
+  return n;
+}
+
+static int close_pid(SceUID pid)
+{
+  int ret = -1;
+
+  ksceKernelLockMutex(chan_mtx_uid, 1, NULL);
+
+  Channel *c = find(pid);
+  if (c)
+  {
+    drain(c);
+    release(c);
+    ret = 0;
+  }
+
+  ksceKernelUnlockMutex(chan_mtx_uid, 1);
+  return ret;
+}
+
+static int proc_exit(SceUID pid, SceProcEventInvokeParam1 *a2, int a3)
+{
+  (void)a2;
+  (void)a3;
+  close_pid(pid);
+  return 0;
+}
+
+static int proc_kill(SceUID pid, SceProcEventInvokeParam1 *a2, int a3)
+{
+  (void)a2;
+  (void)a3;
+  close_pid(pid);
+  return 0;
+}
+
+static SceProcEventHandler proc_handler = {
+  .size = sizeof(SceProcEventHandler),
+  .exit = proc_exit,
+  .kill = proc_kill,
+};
+
+int channel_init(void)
+{
+  chan_mtx_uid = ksceKernelCreateMutex("CatLogChannelMutex", 0, 0, NULL);
+  if (chan_mtx_uid < 0)
+  {
+    return chan_mtx_uid;
+  }
+
+  return ksceKernelRegisterProcEventHandler("CatLogProcEvent", &proc_handler, 0);
+}
+
+int CatLogOpenChannel(size_t size, CatLogChannel_t **channel)
+{
+  int res;
+  uint32_t state;
+  SceKernelAllocMemBlockKernelOpt opt;
+  void *user_base = NULL;
+  SceUID pid      = ksceKernelGetProcessId();
+  Channel *c      = NULL;
+
+  ENTER_SYSCALL(state);
+
+  uint32_t data_len = CATLOG_CHANNEL_MIN_SIZE;
+  while (data_len < size && data_len < CATLOG_CHANNEL_MAX_SIZE)
+  {
+    data_len <<= 1;
+  }
+
+  metrics_watch(pid);
+
+  ksceKernelLockMutex(chan_mtx_uid, 1, NULL);
+
+  if (find(pid))
+  {
+    res = SCE_KERNEL_ERROR_ERROR;
+    goto end;
+  }
+
+  c = find(0);
+  if (!c)
+  {
+    res = SCE_KERNEL_ERROR_NO_MEMORY;
+    goto end;
+  }
+
+  memset(&opt, 0, sizeof(opt));
+  opt.size = sizeof(opt);
+  opt.attr = SCE_KERNEL_ALLOC_MEMBLOCK_ATTR_HAS_PID;
+  opt.pid  = pid;
+
+  c->user_uid = ksceKernelAllocMemBlock("CatLogChannel", SCE_KERNEL_MEMBLOCK_TYPE_USER_RW,
+                                        CATLOG_CHANNEL_DATA_OFFSET + data_len, &opt);
+  if (c->user_uid < 0)
+  {
+    res = c->user_uid;
+    goto fail_user;
+  }
+
+  // same pages, mapped for the kernel so draining is plain loads and stores
+  memset(&opt, 0, sizeof(opt));
+  opt.size           = sizeof(opt);
+  opt.attr           = SCE_KERNEL_ALLOC_MEMBLOCK_ATTR_HAS_MIRROR_BLOCKID;
+  opt.mirror_blockid = c->user_uid;
+
+  c->kernel_uid = ksceKernelAllocMemBlock("CatLogChannelMirror", SCE_KERNEL_MEMBLOCK_TYPE_KERNEL_RW,
+                                          CATLOG_CHANNEL_DATA_OFFSET + data_len, &opt);
+  if (c->kernel_uid < 0)
+  {
+    res = c->kernel_uid;
+    goto fail_kernel;
+  }
+
+  ksceKernelGetMemBlockBase(c->kernel_uid, (void **)&c->ch);
+  ksceKernelGetMemBlockBase(c->user_uid, &user_base);
+
+  memset(c->ch, 0, CATLOG_CHANNEL_DATA_OFFSET + data_len);
+  c->ch->size = data_len;
+  c->data_len = data_len;
+
+  res = ksceKernelMemcpyKernelToUser((void *)channel, &user_base, sizeof(user_base));
+  if (res < 0)
+  {
+    goto fail_copy;
+  }
+
+  c->pid = pid;
+  channels_open++;
+  res = 0;
+  goto end;
+
+fail_copy:
+  ksceKernelFreeMemBlock(c->kernel_uid);
+fail_kernel:
+  ksceKernelFreeMemBlock(c->user_uid);
+fail_user:
+  memset(c, 0, sizeof(*c));
+end:
+  ksceKernelUnlockMutex(chan_mtx_uid, 1);
+
+  EXIT_SYSCALL(state);
+
+  return res;
+}
+
+int CatLogCloseChannel(void)
+{
+  int res;
+  uint32_t state;
+
+  ENTER_SYSCALL(state);
+
+  res = close_pid(ksceKernelGetProcessId());
+
+  EXIT_SYSCALL(state);
+
+  return res;
+}
@@ -0,0 +1,32 @@
+/*
+CatLog
+Copyright (C) 2024 Cat
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+#include <psp2kern/types.h>
+#include <stdint.h>
+
+int channel_init(void);
+
+// moves committed records of all open channels into the ring
+int channel_drain(void);
+int channel_count(void);
+// records dropped by writers of the open channels
+uint32_t channel_dropped(void);
+
+#endif
@@ -0,0 +1,223 @@
+/*
+CatLog
+Copyright (C) 2024 Cat
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+
+#include <psp2kern/io/fcntl.h>
+#include <psp2kern/kernel/threadmgr.h>
+#include <string.h>
+
+#define CFG_PATH "ur0:/data/catlog.cfg"
+#define CFG_MAGIC 0x46434C43 // "CLCF"
+#define CFG_VERSION 1
+#define CFG_LEGACY_SIZE 12 // headerless CatLogConfig_t of 1.0
+#define CFG_SAVE_DELAY (500 * 1000)
+#define CFG_EVF_DIRTY 0x00000001
+
+// On disk: ConfigHeader_t followed by `size` bytes of CatLogConfig_t.
+// Fields are only ever appended to CatLogConfig_t, so a shorter file keeps
+// defaults for the new fields and a longer one (newer build) still loads.
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t size;
+  uint32_t crc;
+} ConfigHeader_t;
+
+CatLogConfig_t Config;
+
+static SceUID cfg_evf_uid    = -1;
+static SceUID cfg_thread_uid = -1;
+static SceUID cfg_mtx_uid    = -1;
+
+static uint32_t crc32(const void *data, int len)
+{
+  const uint8_t *p = data;
+  uint32_t crc     = 0xFFFFFFFF;
+
+  while (len-- > 0)
+  {
+    crc ^= *p++;
+    for (int i = 0; i < 8; i++)
+    {
+      crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+  }
+
+  return ~crc;
+}
+
+static void DefaultConfig(void)
+{
+  memset(&Config, 0, sizeof(Config));
+  Config.host = 0x0100007f; // 127.0.0.1
+  Config.port = DEFAULT_PORT;
+  Config.loglevel = 2;
+  Config.net = 0;
+  Config.format = CATLOG_FORMAT_TEXT;
+  Config.batch_bytes = DEFAULT_BATCH_BYTES;
+  Config.flush_ms = DEFAULT_FLUSH_MS;
+  Config.net_priority = DEFAULT_NET_PRIORITY;
+  Config.net_affinity = 0;
+  Config.min_level = CATLOG_LEVEL_TRACE;
+  Config.sources = 0;
+  Config.metrics_ms = 0;
+}
+
+int SaveConfig(void)
+{
+  struct {
+    ConfigHeader_t hdr;
+    CatLogConfig_t cfg;
+  } __attribute__((packed)) file;
+
+  LockConfig();
+  file.cfg = Config;
+  UnlockConfig();
+
+  file.hdr.magic   = CFG_MAGIC;
+  file.hdr.version = CFG_VERSION;
+  file.hdr.size    = sizeof(file.cfg);
+  file.hdr.crc     = crc32(&file.cfg, sizeof(file.cfg));
+
+  SceUID fd = ksceIoOpen(CFG_PATH, SCE_O_WRONLY | SCE_O_CREAT | SCE_O_TRUNC, 0666);
+  if (fd < 0) return fd;
+
+  ksceIoWrite(fd, &file, sizeof(file));
+  ksceIoClose(fd);
+
+  return 0;
+}
+
+int LoadConfig(void)
+{
+  struct {
+    ConfigHeader_t hdr;
+    char data[0x200];
+  } file;
+  int save = 1;
+
+  DefaultConfig();
+
+  SceUID fd = ksceIoOpen(CFG_PATH, SCE_O_RDONLY, 0);
+  if (fd < 0)
+  {
+    goto end;
+  }
+
+  int res = ksceIoRead(fd, &file, sizeof(file));
+  ksceIoClose(fd);
+
+  if (res >= (int)sizeof(file.hdr) && file.hdr.magic == CFG_MAGIC)
+  {
+    int size = res - sizeof(file.hdr);
+    if (file.hdr.size > size || crc32(file.data, file.hdr.size) != file.hdr.crc)
+    {
+      goto end;
+    }
+
+    memcpy(&Config, file.data, file.hdr.size < sizeof(Config) ? file.hdr.size : sizeof(Config));
+
+    // don't drop fields a newer build wrote
+    save = file.hdr.version < CFG_VERSION || file.hdr.size < sizeof(Config);
+  }
+  else if (res == CFG_LEGACY_SIZE)
+  {
+    memcpy(&Config, &file, CFG_LEGACY_SIZE);
+  }
+
+end:
+  if (save)
+  {
+    SaveConfig();
+  }
+
+  return 0;
+}
+
+static int config_thread(SceSize args, void *argp)
+{
+  (void)args;
+  (void)argp;
+
+  for (;;)
+  {
+    ksceKernelWaitEventFlag(cfg_evf_uid, CFG_EVF_DIRTY, SCE_EVENT_WAITOR | SCE_EVENT_WAITCLEAR, NULL, NULL);
+
+    // the settings page changes one key at a time, wait until it settles
+    while (ksceKernelWaitEventFlag(cfg_evf_uid, CFG_EVF_DIRTY, SCE_EVENT_WAITOR | SCE_EVENT_WAITCLEAR, NULL,
+                                   (SceUInt[]) {CFG_SAVE_DELAY}) >= 0)
+      ;
+
+    SaveConfig();
+  }
+
+  return 0;
+}
+
+// no-ops until StartConfigThread, there is only one thread before that
+void LockConfig(void)
+{
+  if (cfg_mtx_uid >= 0)
+  {
+    ksceKernelLockMutex(cfg_mtx_uid, 1, NULL);
+  }
+}
+
+void UnlockConfig(void)
+{
+  if (cfg_mtx_uid >= 0)
+  {
+    ksceKernelUnlockMutex(cfg_mtx_uid, 1);
+  }
+}
+
+void RequestSaveConfig(void)
+{
+  if (cfg_evf_uid < 0)
+  {
+    SaveConfig();
+    return;
+  }
+
+  ksceKernelSetEventFlag(cfg_evf_uid, CFG_EVF_DIRTY);
+}
+
+int StartConfigThread(void)
+{
+  cfg_mtx_uid = ksceKernelCreateMutex("CatLogConfigMutex", 0, 0, NULL);
+  if (cfg_mtx_uid < 0)
+  {
+    return cfg_mtx_uid;
+  }
+
+  cfg_evf_uid = ksceKernelCreateEventFlag("CatLogConfigEventFlag", 0, 0, NULL);
+  if (cfg_evf_uid < 0)
+  {
+    return cfg_evf_uid;
+  }
+
+  cfg_thread_uid = ksceKernelCreateThread("config_thread", config_thread, 0x60, 0x1000, 0, 0, 0);
+  if (cfg_thread_uid < 0)
+  {
+    ksceKernelDeleteEventFlag(cfg_evf_uid);
+    cfg_evf_uid = -1;
+    return cfg_thread_uid;
+  }
+
+  return ksceKernelStartThread(cfg_thread_uid, 0, NULL);
+}
@@ -0,0 +1,41 @@
+/*
+CatLog
+Copyright (C) 2024 Cat
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include "catlog.h"
+
+#define DEFAULT_PORT 9999
+#define DEFAULT_BATCH_BYTES 0x2000
+#define DEFAULT_FLUSH_MS 50
+#define DEFAULT_NET_PRIORITY 0x40
+
+extern CatLogConfig_t Config;
+
+int LoadConfig(void);
+int SaveConfig(void);
+
+// coalesces changes and writes them from the config thread
+int StartConfigThread(void);
+void RequestSaveConfig(void);
+
+// held while Config is written, and by the save for a consistent snapshot
+void LockConfig(void);
+void UnlockConfig(void);
+
+#endif
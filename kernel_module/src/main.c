@@ -17,7 +17,13 @@ You should have received a copy of the GNU General Public License
 along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
+#define CATLOG_KERNEL
 #include "catlog.h"
+#include "caller.h"
+#include "catlog_event.h"
+#include "channel.h"
+#include "config.h"
+#include "metrics.h"
 #include "ringbuf.h"
 
 #include <psp2/kernel/error.h>
@@ -32,11 +38,26 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <psp2kern/kernel/utils.h>
 #include <psp2kern/netps.h>
 #include <stdarg.h>
+#include <string.h>
 #include <taihen.h>
 
-#define CFG_PATH "ur0:/data/catlog.cfg"
-#define DEFAULT_PORT 9999
-#define RINGBUF_LEN 0x2000
+#define RINGBUF_LEN 0x8000
+#define LINE_LEN 0x100
+#define NET_BUF_LEN 0x4000
+#define WRITE_CHUNK_LEN RINGBUF_USER_MAX
+// below the threshold there is always room left for one more record of any size
+#define NET_BATCH_MAX (NET_BUF_LEN - WRITE_CHUNK_LEN - (int)(sizeof(CatLogRecord_t) + sizeof(CatLogCaller_t)))
+#define NET_BATCH_MIN 0x200
+#define PRINTF_FORWARD_WORDS 12
+#define NET_FLUSH_MIN (2 * 1000)
+#define NET_CMD_POLL_INTERVAL (100 * 1000)
+#define NET_PRIORITY_BOOST 0x20
+#define NET_PRIORITY_HIGHEST 0x10
+#define NET_PRIORITY_MIN 0x40 // range of the setting
+#define NET_PRIORITY_MAX 0xBF
+#define NET_CPU_MASK(cores) (((cores) & 0xF) << 16) // SCE_KERNEL_CPU_MASK_USER_0 << core
+#define CHANNEL_POLL_INTERVAL (10 * 1000)
+#define IDLE_POLL_INTERVAL (1000 * 1000)
 
 int module_get_export_func(SceUID pid, const char *modname, uint32_t libnid, uint32_t funcnid, uintptr_t *func);
 
@@ -57,36 +78,316 @@ int module_get_export_func(SceUID pid, const char *modname, uint32_t libnid, uin
   module_get_export_func(KERNEL_PID, modname, lib_nid, func_nid, (uintptr_t *)func)
 
 
-CatLogConfig_t Config;
-
 static int net_thread_run    = 0;
 static SceUID net_thread_uid = 0;
+static int net_boosted       = 0;
+static int net_flush_req     = 0;
+static int net_reconnect     = 0;
+static int net_batch_framed  = 0;
+static uint64_t net_sent     = 0;
+
+// framed connection the host may send commands on, -1 if none
+static SceUID net_cmd_sock = -1;
+static char net_cmd_buf[sizeof(CatLogCommand_t) * 8];
+static int net_cmd_len;
 
 static SceNetSockaddrIn server;
+static char net_buf[NET_BUF_LEN];
+
+// userland output arrives one character at a time, it is collected into lines first
+static SceUID line_mtx_uid = -1;
+static char line_buf[sizeof(CatLogCaller_t) + LINE_LEN]; // text follows room for the caller
+static int line_len;
+static int line_caller_len;
+static SceUID line_pid;
+static SceUID line_thid;
+static SceInt64 line_time;
 
 int (*sceDebugRegisterPutcharHandlerForKernel)(int (*func)(void *args, char c), void *args);
 int (*sceDebugSetHandlersForKernel)(int (*func)(int unk, const char *format, const va_list args), void *args);
 int (*sceDebugDisableInfoDumpForKernel)(int flags);
 int (*sceKernelSetAssertLevelForKernel)(int level);
 
+static void ApplyConfig(void);
+
+static void record_init(CatLogRecord_t *rec, int type, int level, int source, int size)
+{
+  rec->magic = CATLOG_RECORD_MAGIC;
+  rec->type  = type;
+  rec->level = level;
+  rec->flags = source & CATLOG_FLAG_SOURCE_MASK;
+  rec->cpu   = ksceKernelCpuId();
+  rec->size  = size;
+  rec->pid   = ksceKernelGetProcessId();
+  rec->thid  = ksceKernelGetThreadId();
+  rec->time  = ksceKernelGetSystemTimeWide();
+
+  if (source == CATLOG_SOURCE_USER)
+  {
+    metrics_watch(rec->pid);
+  }
+}
+
+// Caller prefix of a kernel record if enabled, returns its size. Only the address is
+// recorded, net_thread resolves it before sending, see net_resolve_callers.
+static int kernel_record_caller(CatLogCaller_t *caller, uintptr_t addr)
+{
+  if (!Config.caller || !addr)
+  {
+    return 0;
+  }
+  memset(caller, 0, sizeof(*caller));
+  caller->addr = addr;
+  return sizeof(*caller);
+}
+
+// same for a syscall, the caller is where userland entered it
+static int user_record_caller(CatLogCaller_t *caller)
+{
+  ThreadCpuRegisters regs;
+
+  if (!Config.caller || ksceKernelGetThreadCpuRegisters(ksceKernelGetThreadId(), &regs) < 0)
+  {
+    return 0;
+  }
+  memset(caller, 0, sizeof(*caller));
+  caller->addr = regs.user.lr;
+  return sizeof(*caller);
+}
+
+static void line_flush(void)
+{
+  CatLogRecord_t rec;
+
+  if (line_len == 0)
+    return;
+
+  char *payload = line_buf + sizeof(CatLogCaller_t) - line_caller_len;
+
+  record_init(&rec, CATLOG_RECORD_TEXT, CATLOG_LEVEL_INFO, CATLOG_SOURCE_USER, line_caller_len + line_len);
+  rec.flags |= line_caller_len ? CATLOG_FLAG_CALLER : 0;
+  rec.pid  = line_pid;
+  rec.thid = line_thid;
+  rec.time = line_time;
+  ringbuf_put_clobber(&rec, payload);
+
+  line_len = 0;
+}
+
 // userland printf
 int UserDebugPrintfCallback(void *args, char c)
 {
   (void)args;
-  ringbuf_put_clobber(&c, 1);
+  SceUID thid = ksceKernelGetThreadId();
+
+  ksceKernelLockMutex(line_mtx_uid, 1, NULL);
+
+  if (line_len > 0 && line_thid != thid)
+  {
+    line_flush();
+  }
+
+  if (line_len == 0)
+  {
+    line_pid  = ksceKernelGetProcessId();
+    line_thid = thid;
+    line_time = ksceKernelGetSystemTimeWide();
+    line_caller_len = user_record_caller((CatLogCaller_t *)line_buf);
+  }
+
+  line_buf[sizeof(CatLogCaller_t) + line_len++] = c;
+
+  if (c == '\n' || line_len == LINE_LEN)
+  {
+    line_flush();
+  }
+
+  ksceKernelUnlockMutex(line_mtx_uid, 1);
   return 0;
 }
 
+static int clamp_level(int level)
+{
+  if (level < CATLOG_LEVEL_TRACE || level > CATLOG_LEVEL_FATAL)
+  {
+    return CATLOG_LEVEL_INFO;
+  }
+  return level;
+}
+
+// keep ordering with putchar output of the same thread
+static void line_flush_thread(void)
+{
+  ksceKernelLockMutex(line_mtx_uid, 1, NULL);
+  if (line_len > 0 && line_thid == ksceKernelGetThreadId())
+  {
+    line_flush();
+  }
+  ksceKernelUnlockMutex(line_mtx_uid, 1);
+}
+
+int CatLogWrite(const char *buf, size_t len, int level)
+{
+  int res = 0;
+  uint32_t state;
+  CatLogRecord_t rec;
+  CatLogCaller_t caller;
+
+  ENTER_SYSCALL(state);
+
+  level = clamp_level(level);
+  line_flush_thread();
+
+  int caller_len = user_record_caller(&caller);
+
+  while (len > 0)
+  {
+    int chunk = len > WRITE_CHUNK_LEN ? WRITE_CHUNK_LEN : len;
+
+    record_init(&rec, CATLOG_RECORD_TEXT, level, CATLOG_SOURCE_USER, caller_len + chunk);
+    rec.flags |= caller_len ? CATLOG_FLAG_CALLER : 0;
+    int ret = ringbuf_put_clobber_user(&rec, &caller, caller_len, buf);
+    if (ret < 0)
+    {
+      res = res ? res : ret;
+      break;
+    }
+
+    buf += chunk;
+    len -= chunk;
+    res += chunk;
+  }
+
+  EXIT_SYSCALL(state);
+
+  return res;
+}
+
+int CatLogWriteEvent(const void *buf, size_t len, int level)
+{
+  int res;
+  uint32_t state;
+  CatLogRecord_t rec;
+  CatLogCaller_t caller;
+
+  ENTER_SYSCALL(state);
+
+  if (len > CATLOG_EVENT_MAX)
+  {
+    res = SCE_KERNEL_ERROR_ILLEGAL_SIZE;
+    goto end;
+  }
+
+  line_flush_thread();
+
+  int caller_len = user_record_caller(&caller);
+
+  record_init(&rec, CATLOG_RECORD_EVENT, clamp_level(level), CATLOG_SOURCE_USER, caller_len + len);
+  rec.flags |= caller_len ? CATLOG_FLAG_CALLER : 0;
+  res = ringbuf_put_clobber_user(&rec, &caller, caller_len, buf);
+
+end:
+  EXIT_SYSCALL(state);
+
+  return res;
+}
+
+int CatLogWriteEventForDriver(const void *buf, size_t len, int level)
+{
+  CatLogRecord_t rec;
+  char payload[sizeof(CatLogCaller_t) + CATLOG_EVENT_MAX];
+
+  if (len > CATLOG_EVENT_MAX)
+  {
+    return SCE_KERNEL_ERROR_ILLEGAL_SIZE;
+  }
+
+  int caller_len = kernel_record_caller((CatLogCaller_t *)payload, (uintptr_t)__builtin_return_address(0));
+  memcpy(payload + caller_len, buf, len);
+
+  record_init(&rec, CATLOG_RECORD_EVENT, clamp_level(level), CATLOG_SOURCE_KERNEL, caller_len + len);
+  rec.flags |= caller_len ? CATLOG_FLAG_CALLER : 0;
+  return ringbuf_put_clobber(&rec, payload);
+}
+
+static int trace_phase_valid(int phase)
+{
+  return phase == CATLOG_TRACE_BEGIN || phase == CATLOG_TRACE_END || phase == CATLOG_TRACE_COUNTER ||
+         phase == CATLOG_TRACE_INSTANT;
+}
+
+static int trace_put(const CatLogTrace_t *trace, int source)
+{
+  CatLogRecord_t rec;
+
+  record_init(&rec, CATLOG_RECORD_TRACE, CATLOG_LEVEL_INFO, source, sizeof(*trace));
+  return ringbuf_put_clobber(&rec, (const char *)trace);
+}
+
+int CatLogTrace(int phase, const char *name, int64_t value)
+{
+  int res;
+  uint32_t state;
+  CatLogTrace_t trace;
+
+  ENTER_SYSCALL(state);
+
+  if (!trace_phase_valid(phase))
+  {
+    res = SCE_KERNEL_ERROR_INVALID_ARGUMENT;
+    goto end;
+  }
+
+  memset(&trace, 0, sizeof(trace));
+  trace.phase = phase;
+  trace.value = value;
+
+  res = ksceKernelStrncpyUserToKernel(trace.name, name, sizeof(trace.name));
+  if (res < 0)
+  {
+    goto end;
+  }
+
+  res = trace_put(&trace, CATLOG_SOURCE_USER);
+
+end:
+  EXIT_SYSCALL(state);
+
+  return res;
+}
+
+int CatLogTraceForDriver(int phase, const char *name, int64_t value)
+{
+  CatLogTrace_t trace;
+
+  if (!trace_phase_valid(phase))
+  {
+    return SCE_KERNEL_ERROR_INVALID_ARGUMENT;
+  }
+
+  memset(&trace, 0, sizeof(trace));
+  trace.phase = phase;
+  trace.value = value;
+  strncpy(trace.name, name, sizeof(trace.name));
+
+  return trace_put(&trace, CATLOG_SOURCE_KERNEL);
+}
+
 // kernel printf's
 int KernelDebugPrintfCallback(int unk, const char *fmt, const va_list args)
 {
   (void)unk;
-  char buf[0x400];
-  int buf_len = sizeof(buf);
-  int len     = vsnprintf(buf, buf_len, fmt, args);
-  len         = len < 0 ? 0 : len;
-  len         = len >= buf_len ? buf_len - 1 : len;
-  ringbuf_put_clobber(buf, len);
+  char buf[sizeof(CatLogCaller_t) + 0x400];
+  int caller_len = kernel_record_caller((CatLogCaller_t *)buf, caller_take());
+  int buf_len    = sizeof(buf) - caller_len;
+  int len        = vsnprintf(buf + caller_len, buf_len, fmt, args);
+  len            = len < 0 ? 0 : len;
+  len            = len >= buf_len ? buf_len - 1 : len;
+
+  CatLogRecord_t rec;
+  record_init(&rec, CATLOG_RECORD_TEXT, CATLOG_LEVEL_INFO, CATLOG_SOURCE_KERNEL, caller_len + len);
+  rec.flags |= caller_len ? CATLOG_FLAG_CALLER : 0;
+  ringbuf_put_clobber(&rec, buf);
   return 0;
 }
 
@@ -107,6 +408,42 @@ DECL_FUNC_HOOK(ScePower_3e10_patched, int pid, int flags, unsigned int set)
   return TAI_CONTINUE(int, ScePower_3e10_patchedHookRef, pid, flags, set);
 }
 
+// KernelDebugPrintfCallback only sees sysmem internals, the real caller is captured here.
+// The varargs are passed on as the same sequence of words: r1-r3 and then the stack, both
+// 8-byte aligned, so 64-bit arguments keep their place. Formats using more words than
+// PRINTF_FORWARD_WORDS lose the rest.
+DECL_FUNC_HOOK(ksceDebugPrintf, const char *fmt, ...)
+{
+  va_list args;
+  uint32_t w[PRINTF_FORWARD_WORDS];
+
+  caller_mark((uintptr_t)__builtin_return_address(0));
+
+  va_start(args, fmt);
+  for (int i = 0; i < PRINTF_FORWARD_WORDS; i++)
+  {
+    w[i] = va_arg(args, uint32_t);
+  }
+  va_end(args);
+
+  return TAI_CONTINUE(int, ksceDebugPrintfHookRef, fmt, w[0], w[1], w[2], w[3], w[4], w[5], w[6], w[7], w[8], w[9],
+                      w[10], w[11]);
+}
+
+// the hook is only needed, and only installed, while callers are recorded
+static void caller_hook_update(void)
+{
+  if (Config.caller && ksceDebugPrintfHookUid < 0)
+  {
+    BIND_FUNC_EXPORT_HOOK(ksceDebugPrintf, "SceSysmem", 0xFFFFFFFF, 0x391B74B7);
+  }
+  else if (!Config.caller && ksceDebugPrintfHookUid >= 0)
+  {
+    taiHookReleaseForKernel(ksceDebugPrintfHookUid, ksceDebugPrintfHookRef);
+    ksceDebugPrintfHookUid = -1;
+  }
+}
+
 /* flags for sceNetShutdown */
 #define SCE_NET_SHUT_RD 0
 #define SCE_NET_SHUT_WR 1
@@ -142,10 +479,397 @@ socket_error:
 
 static void net_close(int net_sock)
 {
+  if (net_sock == net_cmd_sock)
+  {
+    net_cmd_sock = -1;
+  }
   ksceNetShutdown(net_sock, SCE_NET_SHUT_RDWR);
   ksceNetClose(net_sock);
 }
 
+static int net_hello(int net_sock)
+{
+  struct {
+    CatLogRecord_t rec;
+    CatLogHello_t hello;
+  } __attribute__((packed)) msg;
+
+  if (Config.format != CATLOG_FORMAT_FRAMED)
+    return 0;
+
+  record_init(&msg.rec, CATLOG_RECORD_HELLO, CATLOG_LEVEL_INFO, CATLOG_SOURCE_KERNEL, sizeof(msg.hello));
+  msg.hello.version = CATLOG_PROTO_VERSION;
+
+  return ksceNetSend(net_sock, &msg, sizeof(msg), 0);
+}
+
+// plain text stream, only keep the text payloads
+static int net_strip_records(char *buf, int len)
+{
+  int in  = 0;
+  int out = 0;
+
+  while (in < len)
+  {
+    CatLogRecord_t rec;
+    memcpy(&rec, buf + in, sizeof(rec));
+    in += sizeof(rec);
+
+    if (rec.type == CATLOG_RECORD_TEXT)
+    {
+      int skip = (rec.flags & CATLOG_FLAG_CALLER) ? sizeof(CatLogCaller_t) : 0;
+      if (rec.size < skip)
+      {
+        skip = rec.size;
+      }
+      memmove(buf + out, buf + in + skip, rec.size - skip);
+      out += rec.size - skip;
+    }
+    in += rec.size;
+  }
+
+  return out;
+}
+
+// sends the whole batch, a send that makes no progress is an error
+static int net_send(int net_sock, const char *buf, int len)
+{
+  int off = 0;
+
+  while (off < len)
+  {
+    int ret = ksceNetSend(net_sock, buf + off, len - off, 0);
+    if (ret <= 0)
+    {
+      return ret < 0 ? ret : -1;
+    }
+    off += ret;
+    net_sent += ret;
+  }
+  return off;
+}
+
+// Resolves the caller prefixes of a framed batch in place. Modules seen for the first time
+// on this connection are announced right away so they precede the batch.
+static int net_resolve_callers(int net_sock, char *buf, int len)
+{
+  int off = 0;
+
+  while (off + (int)sizeof(CatLogRecord_t) <= len)
+  {
+    CatLogRecord_t rec;
+    CatLogCaller_t caller;
+    CallerModule msg;
+
+    memcpy(&rec, buf + off, sizeof(rec));
+    off += sizeof(rec);
+
+    if ((rec.flags & CATLOG_FLAG_CALLER) && rec.size >= sizeof(caller))
+    {
+      memcpy(&caller, buf + off, sizeof(caller));
+      if (caller_resolve(rec.pid, caller.addr, &caller, &msg))
+      {
+        msg.rec.thid = rec.thid;
+        msg.rec.time = rec.time;
+        if (net_send(net_sock, (const char *)&msg, sizeof(msg)) < 0)
+        {
+          return -1;
+        }
+      }
+      memcpy(buf + off, &caller, sizeof(caller));
+    }
+    off += rec.size;
+  }
+
+  return 0;
+}
+
+static void net_stats(void)
+{
+  struct {
+    CatLogRecord_t rec;
+    CatLogStats_t stats;
+  } __attribute__((packed)) msg;
+
+  record_init(&msg.rec, CATLOG_RECORD_STATS, CATLOG_LEVEL_INFO, CATLOG_SOURCE_KERNEL, sizeof(msg.stats));
+  msg.stats.ring_size       = ringbuf_size();
+  msg.stats.ring_used       = ringbuf_used();
+  msg.stats.ring_dropped    = ringbuf_dropped();
+  msg.stats.ring_filtered   = ringbuf_filtered();
+  msg.stats.channels        = channel_count();
+  msg.stats.channel_dropped = channel_dropped();
+  msg.stats.bytes_sent      = net_sent;
+
+  ksceNetSend(net_cmd_sock, &msg, sizeof(msg), 0);
+}
+
+static void net_command(const CatLogCommand_t *cmd)
+{
+  switch (cmd->cmd)
+  {
+  case CATLOG_CMD_SET_LEVEL:
+    if (cmd->arg > CATLOG_KERNEL_LEVEL_MAX)
+    {
+      break;
+    }
+    LockConfig();
+    Config.loglevel = cmd->arg;
+    UnlockConfig();
+    ApplyConfig();
+    break;
+  case CATLOG_CMD_SET_FILTER:
+    LockConfig();
+    Config.min_level = cmd->arg & 0xFF;
+    Config.sources   = (cmd->arg >> 8) & 0xFF;
+    UnlockConfig();
+    ApplyConfig();
+    break;
+  case CATLOG_CMD_FLUSH:
+    ksceKernelLockMutex(line_mtx_uid, 1, NULL);
+    line_flush();
+    ksceKernelUnlockMutex(line_mtx_uid, 1);
+    net_flush_req = 1;
+    break;
+  case CATLOG_CMD_STATS:
+    net_stats();
+    break;
+  case CATLOG_CMD_RESIZE:
+    ringbuf_resize(cmd->arg);
+    break;
+  }
+}
+
+// reads pending host commands without blocking
+static void net_poll_commands(void)
+{
+  if (net_cmd_sock < 0)
+  {
+    return;
+  }
+
+  for (;;)
+  {
+    int n = ksceNetRecv(net_cmd_sock, net_cmd_buf + net_cmd_len, sizeof(net_cmd_buf) - net_cmd_len,
+                        SCE_NET_MSG_DONTWAIT);
+    if (n == (int)SCE_NET_ERROR_EAGAIN || n == (int)SCE_NET_ERROR_EINTR)
+    {
+      return;
+    }
+    if (n <= 0)
+    {
+      // the host closed the connection, net_thread reconnects before the next batch is lost in a send
+      net_cmd_sock  = -1;
+      net_reconnect = 1;
+      return;
+    }
+    net_cmd_len += n;
+
+    int off = 0;
+    while (net_cmd_len - off >= (int)sizeof(CatLogCommand_t))
+    {
+      CatLogCommand_t cmd;
+      memcpy(&cmd, net_cmd_buf + off, sizeof(cmd));
+      if (cmd.magic != CATLOG_COMMAND_MAGIC)
+      {
+        // lost sync, look for the next command
+        off++;
+        continue;
+      }
+      net_command(&cmd);
+      off += sizeof(cmd);
+    }
+
+    memmove(net_cmd_buf, net_cmd_buf + off, net_cmd_len - off);
+    net_cmd_len -= off;
+  }
+}
+
+// the configured flush deadline in microseconds
+static int net_flush_time(void)
+{
+  return (Config.flush_ms ? Config.flush_ms : DEFAULT_FLUSH_MS) * 1000;
+}
+
+// A last line without a newline would wait for the next putchar of its thread,
+// it is flushed once older than the flush deadline. Returns the time until the
+// pending line is due, 0 if none is.
+static SceUInt line_flush_stale(void)
+{
+  SceUInt due = 0;
+
+  ksceKernelLockMutex(line_mtx_uid, 1, NULL);
+  if (line_len > 0)
+  {
+    SceInt64 age = ksceKernelGetSystemTimeWide() - line_time;
+    if (age >= net_flush_time())
+    {
+      line_flush();
+    }
+    else
+    {
+      due = net_flush_time() - age;
+    }
+  }
+  ksceKernelUnlockMutex(line_mtx_uid, 1);
+
+  return due;
+}
+
+// Waits up to timeout (0 = forever) for records to append to buf after off,
+// shared channels and held lines are polled meanwhile.
+static int net_receive(char *buf, int off, int size, SceUInt timeout)
+{
+  SceUInt waited = 0;
+
+  for (;;)
+  {
+    channel_drain();
+    net_poll_commands();
+    SceUInt line_due = line_flush_stale();
+
+    SceUInt slice = channel_count() > 0 ? CHANNEL_POLL_INTERVAL : IDLE_POLL_INTERVAL;
+    if (net_cmd_sock >= 0 && slice > NET_CMD_POLL_INTERVAL)
+    {
+      slice = NET_CMD_POLL_INTERVAL;
+    }
+    if (line_due && slice > line_due)
+    {
+      slice = line_due;
+    }
+    if (timeout && timeout - waited < slice)
+    {
+      slice = timeout - waited;
+    }
+
+    int len = ringbuf_get_wait(buf, off, size, (SceUInt[]) {slice});
+    if (len > 0)
+    {
+      return len;
+    }
+
+    // the next record doesn't fit behind off, the batch is full
+    if (off > 0 && ringbuf_used() > 0)
+    {
+      return 0;
+    }
+
+    waited += slice;
+    if (timeout && waited >= timeout)
+    {
+      return 0;
+    }
+  }
+}
+
+// Scales from lo without backlog to hi once a ring's worth is pending. The backlog is
+// what was already collected plus what is still queued, the ring alone is mostly empty here.
+static int batch_scale(int lo, int hi, int collected)
+{
+  int size    = ringbuf_size();
+  int backlog = collected + ringbuf_used();
+  if (hi <= lo || size == 0 || backlog >= size)
+  {
+    return hi;
+  }
+  return lo + (int)((long long)(hi - lo) * backlog / size);
+}
+
+static int batch_threshold(int collected)
+{
+  int max = Config.batch_bytes ? Config.batch_bytes : DEFAULT_BATCH_BYTES;
+  if (max > NET_BATCH_MAX)
+  {
+    max = NET_BATCH_MAX;
+  }
+  return batch_scale(max < NET_BATCH_MIN ? max : NET_BATCH_MIN, max, collected);
+}
+
+static SceUInt batch_deadline(int collected)
+{
+  int max = net_flush_time();
+  return batch_scale(max < NET_FLUSH_MIN ? max : NET_FLUSH_MIN, max, collected);
+}
+
+// Collects records until the batch threshold is reached, the flush deadline of
+// the first record expires, an urgent record arrives or the host asks for a flush.
+// Returns 0 if nothing arrived within timeout (0 = forever) or nothing is left to send.
+static int net_collect(char *buf, SceUInt timeout)
+{
+  int len = net_receive(buf, 0, NET_BUF_LEN, timeout);
+  if (len == 0)
+  {
+    return 0;
+  }
+
+  SceInt64 deadline = ksceKernelGetSystemTimeWide() + batch_deadline(len);
+
+  while (len < batch_threshold(len) && !ringbuf_take_urgent() && !net_flush_req)
+  {
+    SceInt64 left = deadline - ksceKernelGetSystemTimeWide();
+    if (left <= 0)
+    {
+      break;
+    }
+
+    int n = net_receive(buf, len, NET_BUF_LEN, left);
+    if (n == 0)
+    {
+      break;
+    }
+    len += n;
+  }
+
+  net_flush_req = 0;
+
+  // stripped once here, a batch resent after a reconnect is already plain text
+  net_batch_framed = Config.format == CATLOG_FORMAT_FRAMED;
+  if (!net_batch_framed)
+  {
+    len = net_strip_records(buf, len);
+  }
+  return len;
+}
+
+// the configured priority, out of range values would make thread creation fail
+static int net_base_priority(void)
+{
+  int priority = Config.net_priority ? Config.net_priority : DEFAULT_NET_PRIORITY;
+  if (priority < NET_PRIORITY_MIN)
+  {
+    return NET_PRIORITY_MIN;
+  }
+  if (priority > NET_PRIORITY_MAX)
+  {
+    return NET_PRIORITY_MAX;
+  }
+  return priority;
+}
+
+static int net_priority(void)
+{
+  int priority = net_base_priority();
+  if (net_boosted)
+  {
+    priority -= NET_PRIORITY_BOOST;
+    if (priority < NET_PRIORITY_HIGHEST)
+    {
+      priority = NET_PRIORITY_HIGHEST;
+    }
+  }
+  return priority;
+}
+
+// Runs above the configured priority while the ring is more than 3/4 full, drops back once
+// it has been drained below 1/4. Called by the producer filling the ring, net_thread may be starved.
+static void net_pressure(int high)
+{
+  net_boosted = high;
+  if (net_thread_uid > 0)
+  {
+    ksceKernelChangeThreadPriority(net_thread_uid, net_priority());
+  }
+}
+
 static int net_thread(SceSize args, void *argp)
 {
   (void)args;
@@ -159,8 +883,8 @@ static int net_thread(SceSize args, void *argp)
 
   while (net_thread_run)
   {
-    char buf[0x400];
-    int received_len = ringbuf_get_wait(buf, sizeof(buf), NULL);
+    char *buf = net_buf;
+    int received_len = net_collect(buf, 0);
     if (received_len == 0)
     {
       continue;
@@ -169,23 +893,56 @@ static int net_thread(SceSize args, void *argp)
     int net_sock;
 
   connect:
-    net_sock = net_connect();
+    net_sock      = net_connect();
+    net_reconnect = 0;
+    caller_reset();
+
+    if (net_hello(net_sock) < 0)
+    {
+      net_close(net_sock);
+      ksceKernelDelayThread(1000 * 1000);
+      goto connect;
+    }
+
+    if (Config.format == CATLOG_FORMAT_FRAMED)
+    {
+      net_cmd_sock = net_sock;
+      net_cmd_len  = 0;
+    }
 
   send:
-    if (ksceNetSend(net_sock, buf, received_len, 0) < 0)
+    if ((net_batch_framed && net_resolve_callers(net_sock, buf, received_len) < 0) ||
+        net_send(net_sock, buf, received_len) < 0)
     {
       net_close(net_sock);
       ksceKernelDelayThread(1000 * 1000);
       goto connect;
     }
 
-    received_len = ringbuf_get_wait(buf, sizeof(buf), (SceUInt[]) {1000 * 1000});
+  next:
+    received_len = net_collect(buf, 1000 * 1000);
+
+    if (net_reconnect)
+    {
+      net_close(net_sock);
+      if (received_len > 0)
+      {
+        goto connect;
+      }
+      continue;
+    }
 
     if (received_len > 0)
     {
       goto send;
     }
 
+    // framed connections stay open so the host can send commands
+    if (net_sock == net_cmd_sock)
+    {
+      goto next;
+    }
+
     net_close(net_sock);
   }
 
@@ -193,114 +950,99 @@ static int net_thread(SceSize args, void *argp)
 }
 
 
-int SaveConfig(void)
+static void ApplyConfig(void)
 {
-  SceUID fd = ksceIoOpen(CFG_PATH, SCE_O_WRONLY | SCE_O_CREAT | SCE_O_TRUNC, 0666);
-  if (fd < 0) return fd;
-
-  ksceIoWrite(fd, &Config, sizeof(CatLogConfig_t));
-  ksceIoClose(fd);
-
-  return 0;
-}
+  static uint8_t format;
+  uint16_t port = ksceNetHtons(Config.port ? Config.port : DEFAULT_PORT);
 
-int CreateConfig(void)
-{
-  Config.host = 0x0100007f; // 127.0.0.1
-  Config.port = DEFAULT_PORT;
-  Config.loglevel = 2;
-  Config.net = 0;
+  sceKernelSetAssertLevelForKernel(Config.loglevel);
+  ringbuf_set_filter(Config.min_level, Config.sources);
+  caller_hook_update();
 
-  SceUID fd = ksceIoOpen(CFG_PATH, SCE_O_WRONLY | SCE_O_CREAT | SCE_O_TRUNC, 0666);
-  if (fd < 0) return fd;
+  // a new host or format needs a new connection
+  if (server.sin_addr.s_addr != Config.host || server.sin_port != port || format != Config.format)
+  {
+    net_reconnect = 1;
+  }
+  format = Config.format;
 
-  ksceIoWrite(fd, &Config, sizeof(CatLogConfig_t));
-  ksceIoClose(fd);
+  server.sin_len         = sizeof(server);
+  server.sin_family      = SCE_NET_AF_INET;
+  server.sin_addr.s_addr = Config.host;
+  server.sin_port        = port;
 
-  return 0;
+  if (net_thread_uid > 0)
+  {
+    ksceKernelChangeThreadPriority(net_thread_uid, net_priority());
+    ksceKernelChangeThreadCpuAffinityMask(net_thread_uid, NET_CPU_MASK(Config.net_affinity));
+  }
 }
 
-int CheckConfig(void)
+int CatLogUpdateConfig(uint32_t host, uint16_t port, uint16_t level, uint8_t net)
 {
-  SceUID fd = ksceIoOpen(CFG_PATH, SCE_O_RDONLY, 0);
-  if (fd < 0)
-  {
-    return fd;
-  }
+  uint32_t state;
 
-  CatLogConfig_t tmp;
+  ENTER_SYSCALL(state);
 
-  int res = ksceIoRead(fd, &tmp, sizeof(CatLogConfig_t));
+  LockConfig();
+  Config.host = host;
+  Config.port = port;
+  Config.loglevel = level;
+  Config.net = net;
+  UnlockConfig();
+  ApplyConfig();
 
-  if (res != sizeof(CatLogConfig_t))
-  {
-    ksceIoClose(fd);
-    return -1;
-  }
+  RequestSaveConfig();
 
-  ksceIoClose(fd);
+  EXIT_SYSCALL(state);
 
   return 0;
 }
 
-int LoadConfig(void)
+int CatLogSetConfig(const CatLogConfig_t *cfg)
 {
   int res;
-  SceUID fd;
-
-  server.sin_len    = sizeof(server);
-  server.sin_family = SCE_NET_AF_INET;
+  uint32_t state;
+  CatLogConfig_t tmp;
 
-  memset(server.sin_zero, 0, sizeof(server.sin_zero));
+  ENTER_SYSCALL(state);
 
-  fd = ksceIoOpen(CFG_PATH, SCE_O_RDONLY, 0);
-  if (fd < 0)
-  {
-    res = fd;
-    goto end;
-  }
-  res = ksceIoRead(fd, &Config, sizeof(CatLogConfig_t));
-  if (res != sizeof(CatLogConfig_t))
+  res = ksceKernelMemcpyUserToKernel(&tmp, cfg, sizeof(tmp));
+  if (res < 0)
   {
-    res = -1;
     goto end;
   }
 
-  server.sin_addr.s_addr = Config.host;
-  server.sin_port        = ksceNetHtons(Config.port ? Config.port : DEFAULT_PORT);
+  LockConfig();
+  Config = tmp;
+  UnlockConfig();
+  ApplyConfig();
 
-  res = 0;
+  RequestSaveConfig();
 
 end:
-  if (fd > 0)
-  {
-    ksceIoClose(fd);
-  }
+  EXIT_SYSCALL(state);
 
   return res;
 }
 
-
-int CatLogUpdateConfig(uint32_t host, uint16_t port, uint16_t level, uint8_t net)
+int CatLogGetConfig(CatLogConfig_t *cfg)
 {
+  int res;
   uint32_t state;
+  CatLogConfig_t tmp;
 
   ENTER_SYSCALL(state);
 
-  Config.host = host;
-  Config.port = port;
-  Config.loglevel = level;
-  Config.net = net;
-  sceKernelSetAssertLevelForKernel(Config.loglevel);
-
-  server.sin_addr.s_addr = host;
-  server.sin_port        = ksceNetHtons(port ? port : DEFAULT_PORT);
+  LockConfig();
+  tmp = Config;
+  UnlockConfig();
 
-  SaveConfig();
+  res = ksceKernelMemcpyKernelToUser((void *)cfg, &tmp, sizeof(tmp));
 
   EXIT_SYSCALL(state);
 
-  return 0;
+  return res;
 }
 
 int CatLogReadConfig(uint32_t* host, uint16_t* port, uint16_t* level, uint8_t* net)
@@ -347,12 +1089,13 @@ int CatLogInit(void)
 
   ksceIoMkdir("ur0:/data", 0777);
 
-  if (CheckConfig() < 0)
+  ret = LoadConfig();
+  if (ret < 0)
   {
-    CreateConfig();
+    goto end;
   }
 
-  ret = LoadConfig();
+  ret = StartConfigThread();
   if (ret < 0)
   {
     goto end;
@@ -364,6 +1107,25 @@ int CatLogInit(void)
     goto end;
   }
 
+  line_mtx_uid = ksceKernelCreateMutex("CatLogLineMutex", 0, 0, NULL);
+  if (line_mtx_uid < 0)
+  {
+    ret = line_mtx_uid;
+    goto end;
+  }
+
+  ret = channel_init();
+  if (ret < 0)
+  {
+    goto end;
+  }
+
+  ret = metrics_init();
+  if (ret < 0)
+  {
+    goto end;
+  }
+
   tai_module_info_t modInfo;
   modInfo.size = sizeof(tai_module_info_t);
 
@@ -412,12 +1174,13 @@ int CatLogInit(void)
     goto end;
   }
 
-  sceKernelSetAssertLevelForKernel(Config.loglevel);
+  ApplyConfig();
 
   sceDebugSetHandlersForKernel(KernelDebugPrintfCallback, 0);
   sceDebugRegisterPutcharHandlerForKernel(UserDebugPrintfCallback, 0);
 
-  net_thread_uid = ksceKernelCreateThread("net_thread", net_thread, 0x40, 0x1000, 0, 0, 0);
+  net_thread_uid = ksceKernelCreateThread("net_thread", net_thread, net_priority(), 0x1000, 0,
+                                          NET_CPU_MASK(Config.net_affinity), 0);
   if (net_thread_uid < 0)
   {
     ret = net_thread_uid;
@@ -425,6 +1188,7 @@ int CatLogInit(void)
   }
 
   net_thread_run = 1;
+  ringbuf_set_pressure_handler(net_pressure);
 
   ksceKernelStartThread(net_thread_uid, 0, NULL);
 
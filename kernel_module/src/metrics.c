@@ -0,0 +1,217 @@
+/*
+CatLog
+Copyright (C) 2024 Cat
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "metrics.h"
+#include "config.h"
+#include "ringbuf.h"
+
+#include <psp2kern/kernel/cpu.h>
+#include <psp2kern/kernel/sysmem.h>
+#include <psp2kern/kernel/threadmgr.h>
+#include <string.h>
+
+#define METRICS_MAX_PROCESSES 4 // per record, the watched ones take turns
+#define METRICS_WATCH_LEN 16
+#define METRICS_MAX_THREADS 32
+#define METRICS_THREAD_LIST_LEN 64
+#define METRICS_MIN_INTERVAL (100 * 1000)
+#define METRICS_IDLE_INTERVAL (1000 * 1000)
+
+static SceUID metrics_thread_uid = -1;
+static SceUID watched[METRICS_WATCH_LEN];
+static unsigned int watch_next;
+
+// only touched by metrics_thread
+static SceUID thread_list[METRICS_THREAD_LIST_LEN];
+static SceKernelThreadInfo thread_info;
+static int sample_next;
+static struct {
+  CatLogRecord_t rec;
+  CatLogMetrics_t m;
+  CatLogMetricsProcess_t proc[METRICS_MAX_PROCESSES];
+  CatLogMetricsThread_t thread[METRICS_MAX_THREADS];
+} __attribute__((packed)) msg;
+
+void metrics_watch(SceUID pid)
+{
+  for (int i = 0; i < METRICS_WATCH_LEN; i++)
+  {
+    if (watched[i] == pid)
+    {
+      return;
+    }
+  }
+
+  for (int i = 0; i < METRICS_WATCH_LEN; i++)
+  {
+    if (watched[i] == 0 && __sync_bool_compare_and_swap(&watched[i], 0, pid))
+    {
+      return;
+    }
+  }
+
+  // all taken by live processes, newcomers replace the entries in turn
+  watched[__sync_fetch_and_add(&watch_next, 1) % METRICS_WATCH_LEN] = pid;
+}
+
+// adds pid and its first threads to msg, returns 0 once the process is gone
+static int sample_process(SceUID pid, int *n_thread)
+{
+  int count = 0;
+
+  if (ksceKernelGetThreadIdList(pid, thread_list, METRICS_THREAD_LIST_LEN, &count) < 0)
+  {
+    return 0;
+  }
+
+  CatLogMetricsProcess_t *p = &msg.proc[msg.m.process_count++];
+  p->pid      = pid;
+  p->threads  = count;
+  p->run_time = 0;
+
+  if (count >= METRICS_THREAD_LIST_LEN)
+  {
+    msg.m.flags |= CATLOG_METRICS_THREADS_TRUNCATED;
+  }
+
+  for (int i = 0; i < count; i++)
+  {
+    thread_info.size = sizeof(thread_info);
+    if (ksceKernelGetThreadInfo(thread_list[i], &thread_info) < 0)
+    {
+      continue;
+    }
+
+    p->run_time += thread_info.runClocks;
+
+    if (*n_thread < METRICS_MAX_THREADS)
+    {
+      CatLogMetricsThread_t *t = &msg.thread[(*n_thread)++];
+      t->pid      = pid;
+      t->thid     = thread_list[i];
+      t->run_time = thread_info.runClocks;
+      memcpy(t->name, thread_info.name, sizeof(t->name));
+    }
+    else
+    {
+      msg.m.flags |= CATLOG_METRICS_THREADS_TRUNCATED;
+    }
+  }
+
+  return 1;
+}
+
+static void sample(void)
+{
+  SceKernelFreeMemorySizeInfo mem;
+  int n_thread = 0;
+
+  memset(&msg.m, 0, sizeof(msg.m));
+
+  mem.size = sizeof(mem);
+  if (ksceKernelGetFreeMemorySize(&mem) >= 0)
+  {
+    msg.m.free_user    = mem.size_user;
+    msg.m.free_cdram   = mem.size_cdram;
+    msg.m.free_phycont = mem.size_phycont;
+  }
+
+  msg.m.ring_size    = ringbuf_size();
+  msg.m.ring_used    = ringbuf_used();
+  msg.m.ring_dropped = ringbuf_dropped();
+
+  // starts after the last process of the previous sample, so all watched ones get their turn
+  int next = sample_next;
+  for (int n = 0; n < METRICS_WATCH_LEN; n++)
+  {
+    int i      = (sample_next + n) % METRICS_WATCH_LEN;
+    SceUID pid = watched[i];
+    if (!pid)
+    {
+      continue;
+    }
+
+    if (msg.m.process_count == METRICS_MAX_PROCESSES)
+    {
+      msg.m.flags |= CATLOG_METRICS_PROCESSES_TRUNCATED;
+      msg.m.processes_watched++;
+      continue;
+    }
+
+    if (!sample_process(pid, &n_thread))
+    {
+      // exited, the slot is free for the next process that logs
+      __sync_bool_compare_and_swap(&watched[i], pid, 0);
+      continue;
+    }
+    msg.m.processes_watched++;
+    next = (i + 1) % METRICS_WATCH_LEN;
+  }
+  sample_next        = next;
+  msg.m.thread_count = n_thread;
+
+  // the thread entries follow the used process entries directly
+  int proc_len   = msg.m.process_count * sizeof(CatLogMetricsProcess_t);
+  int thread_len = n_thread * sizeof(CatLogMetricsThread_t);
+  memmove((char *)msg.proc + proc_len, msg.thread, thread_len);
+
+  msg.rec.magic = CATLOG_RECORD_MAGIC;
+  msg.rec.type  = CATLOG_RECORD_METRICS;
+  msg.rec.level = CATLOG_LEVEL_INFO;
+  msg.rec.flags = CATLOG_SOURCE_KERNEL;
+  msg.rec.cpu   = ksceKernelCpuId();
+  msg.rec.size  = sizeof(msg.m) + proc_len + thread_len;
+  msg.rec.pid   = KERNEL_PID;
+  msg.rec.thid  = ksceKernelGetThreadId();
+  msg.rec.time  = ksceKernelGetSystemTimeWide();
+
+  ringbuf_put_clobber(&msg.rec, (const char *)&msg.m);
+}
+
+static int metrics_thread(SceSize args, void *argp)
+{
+  (void)args;
+  (void)argp;
+
+  for (;;)
+  {
+    int interval = Config.metrics_ms * 1000;
+
+    if (interval == 0)
+    {
+      ksceKernelDelayThread(METRICS_IDLE_INTERVAL);
+      continue;
+    }
+
+    ksceKernelDelayThread(interval < METRICS_MIN_INTERVAL ? METRICS_MIN_INTERVAL : interval);
+    sample();
+  }
+
+  return 0;
+}
+
+int metrics_init(void)
+{
+  // below everything that logs, a late sample costs nothing
+  metrics_thread_uid = ksceKernelCreateThread("metrics_thread", metrics_thread, 0xA0, 0x1000, 0, 0, 0);
+  if (metrics_thread_uid < 0)
+  {
+    return metrics_thread_uid;
+  }
+
+  return ksceKernelStartThread(metrics_thread_uid, 0, NULL);
+}
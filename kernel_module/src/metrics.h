@@ -0,0 +1,30 @@
+/*
+CatLog
+Copyright (C) 2024 Cat
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <psp2kern/types.h>
+
+// Starts the thread queueing a CATLOG_RECORD_METRICS record every Config.metrics_ms,
+// it idles while that is 0.
+int metrics_init(void);
+
+// adds a process to the run time sample, called for every process that logs
+void metrics_watch(SceUID pid);
+
+#endif
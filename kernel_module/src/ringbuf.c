@@ -19,11 +19,15 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "ringbuf.h"
 
+#include <psp2/kernel/error.h>
 #include <psp2kern/kernel/sysmem.h>
 #include <psp2kern/kernel/threadmgr.h>
+#include <string.h>
 
 #define SCE_KERNEL_ATTR_THREAD_FIFO (0x00000000U)
 #define RINGBUF_EVF_NON_EMPTY 0x00000001
+#define RINGBUF_MEMBLOCK_TYPE 0x6020D006
+#define RINGBUF_EVF_URGENT 0x00000002 // a record of CATLOG_LEVEL_ERROR or above was queued
 
 static SceUID evf_uid      = -1;
 static SceUID mtx_uid      = -1;
@@ -31,62 +35,207 @@ static SceUID memblock_uid = -1;
 
 static int buf_len    = 0;
 static char *base_ptr = NULL;
-static char *get_ptr  = NULL;
-static char *put_ptr  = NULL;
+static int get_off    = 0;
+static int put_off    = 0;
+static int used       = 0;
 
-static int idx(char *ptr)
+static int filter_level    = 0;
+static int filter_sources  = 0;
+static uint32_t n_dropped  = 0;
+static uint32_t n_filtered = 0;
+
+// userland payloads are copied here first, only used with the mutex held
+static char user_buf[RINGBUF_USER_MAX];
+
+static int pressure = 0;
+static void (*pressure_fn)(int high);
+
+static int idx(int off)
+{
+  return off % buf_len;
+}
+
+static int fits(int size)
+{
+  return used + size <= buf_len;
+}
+
+static void copy_in(const char *c, int size)
+{
+  int first = buf_len - put_off;
+  if (first > size)
+  {
+    first = size;
+  }
+  memcpy(base_ptr + put_off, c, first);
+  memcpy(base_ptr, c + first, size - first);
+  put_off = idx(put_off + size);
+  used += size;
+}
+
+static void copy_out(char *c, int size)
+{
+  int first = buf_len - get_off;
+  if (first > size)
+  {
+    first = size;
+  }
+  memcpy(c, base_ptr + get_off, first);
+  memcpy(c + first, base_ptr, size - first);
+}
+
+static int record_len(void)
 {
-  return (unsigned int)ptr % buf_len;
+  CatLogRecord_t rec;
+  copy_out((char *)&rec, sizeof(rec));
+  return sizeof(rec) + rec.size;
 }
 
-static void inc(char **ptr)
+static void drop(int size)
 {
-  *ptr = base_ptr + idx(*ptr + 1);
+  get_off = idx(get_off + size);
+  used -= size;
 }
 
-static int empty(void)
+// metadata and metrics records describe the system rather than log anything, they bypass the filter
+static int is_metadata(const CatLogRecord_t *rec)
 {
-  return get_ptr == put_ptr;
+  return rec->type == CATLOG_RECORD_HELLO || rec->type == CATLOG_RECORD_MODULE || rec->type == CATLOG_RECORD_METRICS;
 }
 
-static int full(void)
+static int wanted(const CatLogRecord_t *rec)
 {
-  return idx(put_ptr + 1) == idx(get_ptr);
+  if (is_metadata(rec))
+  {
+    return 1;
+  }
+
+  // trace events have no severity of their own, only their source counts
+  int below = rec->type != CATLOG_RECORD_TRACE && rec->level < filter_level;
+
+  if (below || (filter_sources && !(filter_sources & (1 << (rec->flags & CATLOG_FLAG_SOURCE_MASK)))))
+  {
+    n_filtered++;
+    return 0;
+  }
+  return 1;
 }
 
-static int put(char c)
+// Above 3/4 of the ring the pressure is high, it stays high until drained below 1/4.
+// Returns the new state on a change, -1 otherwise. Called with the mutex held.
+static int pressure_update(void)
 {
-  if (full())
+  int high = pressure ? used * 4 > buf_len : used * 4 >= buf_len * 3;
+  if (high == pressure)
   {
     return -1;
   }
-  *put_ptr = c;
-  inc(&put_ptr);
-  return 0;
+  pressure = high;
+  return high;
 }
 
-static int put_clobber(char c)
+// the handler runs without the mutex, it may queue records itself
+static void pressure_notify(int change)
 {
-  if (full())
+  if (change >= 0 && pressure_fn)
   {
-    inc(&get_ptr);
+    pressure_fn(change);
   }
-  *put_ptr = c;
-  inc(&put_ptr);
-  return 0;
 }
 
-static int get(char *c)
+static void notify(const CatLogRecord_t *rec)
+{
+  ksceKernelSetEventFlag(evf_uid,
+                         RINGBUF_EVF_NON_EMPTY | (rec->level >= CATLOG_LEVEL_ERROR ? RINGBUF_EVF_URGENT : 0));
+}
+
+static int put(const CatLogRecord_t *rec, const char *c)
+{
+  int size = sizeof(*rec) + rec->size;
+  if (!fits(size))
+  {
+    return -1;
+  }
+  copy_in((const char *)rec, sizeof(*rec));
+  copy_in(c, rec->size);
+  return size;
+}
+
+static int make_room(int size)
 {
-  if (empty())
+  if (size > buf_len)
   {
     return -1;
   }
-  *c = *get_ptr;
-  inc(&get_ptr);
+  while (!fits(size))
+  {
+    drop(record_len());
+    n_dropped++;
+  }
   return 0;
 }
 
+static int put_clobber(const CatLogRecord_t *rec, const char *c)
+{
+  if (make_room(sizeof(*rec) + rec->size) < 0)
+  {
+    return -1;
+  }
+  return put(rec, c);
+}
+
+static int put_clobber_user(const CatLogRecord_t *rec, const void *prefix, int prefix_len, const char *c)
+{
+  int size     = sizeof(*rec) + rec->size;
+  int user_len = rec->size - prefix_len;
+  if (user_len < 0 || user_len > RINGBUF_USER_MAX)
+  {
+    return -1;
+  }
+
+  // a bad pointer must not cost the records make_room would evict
+  int ret = ksceKernelMemcpyUserToKernel(user_buf, c, user_len);
+  if (ret < 0)
+  {
+    return ret;
+  }
+
+  if (make_room(size) < 0)
+  {
+    return -1;
+  }
+  copy_in((const char *)rec, sizeof(*rec));
+  copy_in(prefix, prefix_len);
+  copy_in(user_buf, user_len);
+  return size;
+}
+
+static int get(char *c, int off, int size)
+{
+  int n_get = 0;
+
+  while (used > 0)
+  {
+    int len = record_len();
+    if (off + n_get + len > size)
+    {
+      if (len > size)
+      {
+        // can never be handed out, don't let it block the ring
+        drop(len);
+        n_dropped++;
+        continue;
+      }
+      break;
+    }
+    copy_out(c + off + n_get, len);
+    drop(len);
+    n_get += len;
+  }
+
+  return n_get;
+}
+
 int ringbuf_init(int size)
 {
   int ret = 0;
@@ -106,7 +255,7 @@ int ringbuf_init(int size)
     goto fail_mtx;
   }
 
-  memblock_uid = ksceKernelAllocMemBlock("RingBufferMemBlock", 0x6020D006, size, NULL);
+  memblock_uid = ksceKernelAllocMemBlock("RingBufferMemBlock", RINGBUF_MEMBLOCK_TYPE, size, NULL);
   if (memblock_uid < 0)
   {
     ret = memblock_uid;
@@ -115,7 +264,7 @@ int ringbuf_init(int size)
   ksceKernelGetMemBlockBase(memblock_uid, (void **)&base_ptr);
 
   buf_len = size;
-  get_ptr = put_ptr = base_ptr;
+  get_off = put_off = used = 0;
   return 0;
 
 fail_memblock:
@@ -133,83 +282,77 @@ int ringbuf_term(void)
   ksceKernelFreeMemBlock(memblock_uid);
   mtx_uid = memblock_uid = -1;
   buf_len                = 0;
-  base_ptr = get_ptr = put_ptr = NULL;
+  base_ptr               = NULL;
+  get_off = put_off = used = 0;
   return 0;
 }
 
-int ringbuf_put(char *c, int size)
+int ringbuf_put(const CatLogRecord_t *rec, const char *c)
 {
-  int n_put = 0;
   ksceKernelLockMutex(mtx_uid, 1, NULL);
 
-  while (size-- > 0)
-  {
-    if (put(*c++) == 0)
-    {
-      n_put++;
-    }
-    else
-    {
-      break;
-    }
-  }
-
+  int n_put = wanted(rec) ? put(rec, c) : 0;
   if (n_put > 0)
   {
-    ksceKernelSetEventFlag(evf_uid, RINGBUF_EVF_NON_EMPTY);
+    notify(rec);
   }
+  int change = pressure_update();
 
   ksceKernelUnlockMutex(mtx_uid, 1);
+  pressure_notify(change);
   return n_put;
 }
 
-int ringbuf_put_clobber(char *c, int size)
+int ringbuf_put_clobber(const CatLogRecord_t *rec, const char *c)
 {
-  int n_put = 0;
   ksceKernelLockMutex(mtx_uid, 1, NULL);
 
-  while (size-- > 0)
+  int n_put = wanted(rec) ? put_clobber(rec, c) : 0;
+  if (n_put > 0)
   {
-    put_clobber(*c++);
-    n_put++;
+    notify(rec);
   }
+  int change = pressure_update();
+
+  ksceKernelUnlockMutex(mtx_uid, 1);
+  pressure_notify(change);
+  return n_put;
+}
 
+int ringbuf_put_clobber_user(const CatLogRecord_t *rec, const void *prefix, int prefix_len, const char *c)
+{
+  ksceKernelLockMutex(mtx_uid, 1, NULL);
+
+  int n_put = wanted(rec) ? put_clobber_user(rec, prefix, prefix_len, c) : 0;
   if (n_put > 0)
   {
-    ksceKernelSetEventFlag(evf_uid, RINGBUF_EVF_NON_EMPTY);
+    notify(rec);
   }
+  int change = pressure_update();
 
   ksceKernelUnlockMutex(mtx_uid, 1);
+  pressure_notify(change);
   return n_put;
 }
 
-int ringbuf_get(char *c, int size)
+int ringbuf_get(char *c, int off, int size)
 {
-  int n_get = 0;
   ksceKernelLockMutex(mtx_uid, 1, NULL);
 
-  while (size-- > 0)
-  {
-    if (get(c++) == 0)
-    {
-      n_get++;
-    }
-    else
-    {
-      break;
-    }
-  }
+  int n_get = get(c, off, size);
 
-  if (empty())
+  if (used == 0)
   {
     ksceKernelClearEventFlag(evf_uid, ~RINGBUF_EVF_NON_EMPTY);
   }
+  int change = pressure_update();
 
   ksceKernelUnlockMutex(mtx_uid, 1);
+  pressure_notify(change);
   return n_get;
 }
 
-int ringbuf_get_wait(char *c, int size, SceUInt *timeout)
+int ringbuf_get_wait(char *c, int off, int size, SceUInt *timeout)
 {
   int n_get = 0;
   int ret   = ksceKernelWaitEventFlag(evf_uid, RINGBUF_EVF_NON_EMPTY, SCE_EVENT_WAITAND, NULL, timeout);
@@ -219,24 +362,94 @@ int ringbuf_get_wait(char *c, int size, SceUInt *timeout)
   }
   ksceKernelLockMutex(mtx_uid, 1, NULL);
 
-  while (size-- > 0)
-  {
-    if (get(c++) == 0)
-    {
-      n_get++;
-    }
-    else
-    {
-      break;
-    }
-  }
+  n_get = get(c, off, size);
 
-  if (empty())
+  if (used == 0)
   {
     ksceKernelClearEventFlag(evf_uid, ~RINGBUF_EVF_NON_EMPTY);
   }
+  int change = pressure_update();
 
   ksceKernelUnlockMutex(mtx_uid, 1);
+  pressure_notify(change);
 done:
   return n_get;
 }
+
+// consumes the urgent flush request, if any
+int ringbuf_take_urgent(void)
+{
+  return ksceKernelPollEventFlag(evf_uid, RINGBUF_EVF_URGENT, SCE_EVENT_WAITOR | SCE_EVENT_WAITCLEAR_PAT, NULL) == 0;
+}
+
+int ringbuf_used(void)
+{
+  return used;
+}
+
+int ringbuf_size(void)
+{
+  return buf_len;
+}
+
+// Moves the queued records into a new block of `size` bytes, the oldest ones are dropped if they don't fit.
+int ringbuf_resize(int size)
+{
+  SceUID new_uid;
+  char *new_base;
+
+  size = (size + 0xFFF) & ~0xFFF;
+  if (size < RINGBUF_MIN_LEN || size > RINGBUF_MAX_LEN)
+  {
+    return SCE_KERNEL_ERROR_INVALID_ARGUMENT;
+  }
+
+  new_uid = ksceKernelAllocMemBlock("RingBufferMemBlock", RINGBUF_MEMBLOCK_TYPE, size, NULL);
+  if (new_uid < 0)
+  {
+    return new_uid;
+  }
+  ksceKernelGetMemBlockBase(new_uid, (void **)&new_base);
+
+  ksceKernelLockMutex(mtx_uid, 1, NULL);
+
+  while (used > size)
+  {
+    drop(record_len());
+    n_dropped++;
+  }
+  copy_out(new_base, used);
+
+  SceUID old_uid = memblock_uid;
+  memblock_uid   = new_uid;
+  base_ptr       = new_base;
+  buf_len        = size;
+  get_off        = 0;
+  put_off        = used % size;
+
+  ksceKernelUnlockMutex(mtx_uid, 1);
+
+  ksceKernelFreeMemBlock(old_uid);
+  return 0;
+}
+
+void ringbuf_set_pressure_handler(void (*fn)(int high))
+{
+  pressure_fn = fn;
+}
+
+void ringbuf_set_filter(int min_level, int sources)
+{
+  filter_level   = min_level;
+  filter_sources = sources;
+}
+
+uint32_t ringbuf_dropped(void)
+{
+  return n_dropped;
+}
+
+uint32_t ringbuf_filtered(void)
+{
+  return n_filtered;
+}
@@ -20,14 +20,38 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #ifndef RINGBUF_H
 #define RINGBUF_H
 
+#include "catlog_proto.h"
+
 #include <psp2kern/types.h>
 
+#define RINGBUF_MIN_LEN 0x2000
+#define RINGBUF_MAX_LEN 0x100000
+#define RINGBUF_USER_MAX 0x1000
+
+// The ring holds whole records (CatLogRecord_t + payload), clobbering
+// always drops the oldest record and readers only get complete records.
+
 int ringbuf_init(int size);
 int ringbuf_term(void);
 
-int ringbuf_put(char *c, int size);
-int ringbuf_put_clobber(char *c, int size);
-int ringbuf_get(char *c, int size);
-int ringbuf_get_wait(char *c, int size, SceUInt *timeout);
+int ringbuf_put(const CatLogRecord_t *rec, const char *c);
+int ringbuf_put_clobber(const CatLogRecord_t *rec, const char *c);
+// the payload is prefix_len bytes of prefix followed by the rest, at most RINGBUF_USER_MAX bytes, from the userland pointer c
+int ringbuf_put_clobber_user(const CatLogRecord_t *rec, const void *prefix, int prefix_len, const char *c);
+// Appends whole records to the size byte buffer c after its first off bytes, returns the bytes added.
+// A record that doesn't fit stays queued, only one larger than the whole buffer is dropped.
+int ringbuf_get(char *c, int off, int size);
+int ringbuf_get_wait(char *c, int off, int size, SceUInt *timeout);
+int ringbuf_take_urgent(void);
+int ringbuf_used(void);
+int ringbuf_size(void);
+
+int ringbuf_resize(int size);
+// records below min_level or from a source not in the mask (0 = all) are not queued
+void ringbuf_set_filter(int min_level, int sources);
+// called by whoever crosses the fill level, so a starved reader still gets boosted by its producers
+void ringbuf_set_pressure_handler(void (*fn)(int high));
+uint32_t ringbuf_dropped(void);
+uint32_t ringbuf_filtered(void);
 
 #endif
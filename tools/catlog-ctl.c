@@ -0,0 +1,173 @@
+/*
+CatLog
+Copyright (C) 2024 Cat
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+// catlog-ctl - sends remote control commands to devices through catlogd.
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "control.h"
+
+static const char *level_names[] = {"trace", "debug", "info", "warn", "error", "fatal"};
+
+static void usage(const char *argv0)
+{
+  fprintf(stderr,
+          "usage: %s [-d dir] <device ip|all> <command> [args]\n"
+          "  -d dir                  catlogd output directory (default .)\n"
+          "commands:\n"
+          "  level <0-2>             kernel log level, as in the settings menu\n"
+          "  filter <level> [source] drop records below level (trace..fatal), keep only kernel or user records\n"
+          "  flush                   send everything queued right away\n"
+          "  stats                   ring and network counters, printed by catlogd\n"
+          "  resize <bytes>          resize the ring\n",
+          argv0);
+}
+
+static int parse_level(const char *s)
+{
+  for (size_t i = 0; i < sizeof(level_names) / sizeof(level_names[0]); i++)
+  {
+    if (strcmp(s, level_names[i]) == 0)
+      return i;
+  }
+
+  char *end;
+  long level = strtol(s, &end, 0);
+  return *end || level < CATLOG_LEVEL_TRACE || level > CATLOG_LEVEL_FATAL ? -1 : (int)level;
+}
+
+static int parse_command(int argc, char *argv[], CatLogCommand_t *cmd)
+{
+  const char *name = argv[0];
+
+  cmd->magic = CATLOG_COMMAND_MAGIC;
+
+  if (strcmp(name, "level") == 0 && argc == 2)
+  {
+    char *end;
+    long level = strtol(argv[1], &end, 0);
+    if (*end || level < 0 || level > CATLOG_KERNEL_LEVEL_MAX)
+    {
+      fprintf(stderr, "level: 0 (default), 1 (debug) or 2 (trace)\n");
+      return -1;
+    }
+    cmd->cmd = CATLOG_CMD_SET_LEVEL;
+    cmd->arg = level;
+  }
+  else if (strcmp(name, "filter") == 0 && (argc == 2 || argc == 3))
+  {
+    int level       = parse_level(argv[1]);
+    uint32_t source = 0;
+
+    if (level < 0)
+      return -1;
+    if (argc == 3)
+    {
+      if (strcmp(argv[2], "kernel") == 0)
+        source = 1u << CATLOG_SOURCE_KERNEL;
+      else if (strcmp(argv[2], "user") == 0)
+        source = 1u << CATLOG_SOURCE_USER;
+      else if (strcmp(argv[2], "all") != 0)
+        return -1;
+    }
+
+    cmd->cmd = CATLOG_CMD_SET_FILTER;
+    cmd->arg = level | source << 8;
+  }
+  else if (strcmp(name, "flush") == 0 && argc == 1)
+  {
+    cmd->cmd = CATLOG_CMD_FLUSH;
+  }
+  else if (strcmp(name, "stats") == 0 && argc == 1)
+  {
+    cmd->cmd = CATLOG_CMD_STATS;
+  }
+  else if (strcmp(name, "resize") == 0 && argc == 2)
+  {
+    cmd->cmd = CATLOG_CMD_RESIZE;
+    cmd->arg = strtoul(argv[1], NULL, 0);
+  }
+  else
+  {
+    return -1;
+  }
+
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  const char *dir = ".";
+  control_msg_t msg = {0};
+  int opt;
+
+  while ((opt = getopt(argc, argv, "d:h")) != -1)
+  {
+    switch (opt)
+    {
+    case 'd':
+      dir = optarg;
+      break;
+    default:
+      usage(argv[0]);
+      return opt == 'h' ? 0 : 1;
+    }
+  }
+
+  if (argc - optind < 2)
+  {
+    usage(argv[0]);
+    return 1;
+  }
+
+  const char *device = argv[optind];
+  if (strcmp(device, "all") == 0)
+  {
+    msg.addr = htonl(INADDR_ANY);
+  }
+  else if (inet_pton(AF_INET, device, &msg.addr) != 1)
+  {
+    fprintf(stderr, "catlog-ctl: bad device address %s\n", device);
+    return 1;
+  }
+
+  if (parse_command(argc - optind - 1, argv + optind + 1, &msg.cmd) < 0)
+  {
+    usage(argv[0]);
+    return 1;
+  }
+
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/%s", dir, CONTROL_SOCKET);
+
+  int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (fd < 0 || sendto(fd, &msg, sizeof(msg), 0, (struct sockaddr *)&addr, sizeof(addr)) != sizeof(msg))
+  {
+    perror(addr.sun_path);
+    return 1;
+  }
+
+  close(fd);
+  return 0;
+}
@@ -0,0 +1,344 @@
+/*
+CatLog
+Copyright (C) 2024 Cat
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// catlog-decode - turns a framed stream into JSON lines, one object per record.
+
+#define _GNU_SOURCE
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "catlog_event.h"
+#include "reader.h"
+
+// reads a length prefixed string, prefix_len is 1 or 2
+static int take_str(const char *p, size_t len, size_t *off, int prefix_len, const char **s, size_t *s_len)
+{
+  if (*off + prefix_len > len)
+    return -1;
+
+  size_t n = (uint8_t)p[*off];
+  if (prefix_len == 2)
+    n |= (size_t)(uint8_t)p[*off + 1] << 8;
+  *off += prefix_len;
+
+  if (*off + n > len)
+    return -1;
+  *s     = p + *off;
+  *s_len = n;
+  *off += n;
+  return 0;
+}
+
+// JSON has no nan or infinity, they become null
+static void print_float(FILE *out, double v, int digits)
+{
+  if (isfinite(v))
+    fprintf(out, "%.*g", digits, v);
+  else
+    fputs("null", out);
+}
+
+static int decode_event(FILE *out, const char *p, size_t len)
+{
+  size_t off = 0;
+  const char *s;
+  size_t s_len;
+
+  if (take_str(p, len, &off, 1, &s, &s_len) < 0)
+    return -1;
+
+  fputs(",\"name\":", out);
+  json_string(out, s, s_len);
+  fputs(",\"fields\":{", out);
+
+  for (int first = 1; off < len; first = 0)
+  {
+    uint8_t type = p[off++];
+
+    if (take_str(p, len, &off, 1, &s, &s_len) < 0)
+      return -1;
+
+    if (!first)
+      fputc(',', out);
+    json_string(out, s, s_len);
+    fputc(':', out);
+
+    union {
+      int32_t i32;
+      int64_t i64;
+      uint32_t u32;
+      uint64_t u64;
+      float f32;
+      double f64;
+      uint8_t b;
+    } v;
+    size_t width = 0;
+
+    switch (type)
+    {
+    case CATLOG_FIELD_I32:
+    case CATLOG_FIELD_U32:
+    case CATLOG_FIELD_F32:
+      width = 4;
+      break;
+    case CATLOG_FIELD_I64:
+    case CATLOG_FIELD_U64:
+    case CATLOG_FIELD_F64:
+      width = 8;
+      break;
+    case CATLOG_FIELD_BOOL:
+      width = 1;
+      break;
+    case CATLOG_FIELD_STR:
+      if (take_str(p, len, &off, 2, &s, &s_len) < 0)
+        return -1;
+      json_string(out, s, s_len);
+      continue;
+    default:
+      return -1;
+    }
+
+    if (off + width > len)
+      return -1;
+    memcpy(&v, p + off, width);
+    off += width;
+
+    switch (type)
+    {
+    case CATLOG_FIELD_I32:
+      fprintf(out, "%" PRId32, v.i32);
+      break;
+    case CATLOG_FIELD_I64:
+      fprintf(out, "%" PRId64, v.i64);
+      break;
+    case CATLOG_FIELD_U32:
+      fprintf(out, "%" PRIu32, v.u32);
+      break;
+    case CATLOG_FIELD_U64:
+      fprintf(out, "%" PRIu64, v.u64);
+      break;
+    case CATLOG_FIELD_F32:
+      print_float(out, v.f32, 9);
+      break;
+    case CATLOG_FIELD_F64:
+      print_float(out, v.f64, 17);
+      break;
+    case CATLOG_FIELD_BOOL:
+      fputs(v.b ? "true" : "false", out);
+      break;
+    }
+  }
+
+  fputc('}', out);
+  return 0;
+}
+
+static int decode_metrics(FILE *out, const char *p, size_t len)
+{
+  CatLogMetrics_t m;
+
+  if (len < sizeof(m))
+    return -1;
+  memcpy(&m, p, sizeof(m));
+  p += sizeof(m);
+  if (len - sizeof(m) < m.process_count * sizeof(CatLogMetricsProcess_t) + m.thread_count * sizeof(CatLogMetricsThread_t))
+    return -1;
+
+  fprintf(out,
+          ",\"free_user\":%u,\"free_cdram\":%u,\"free_phycont\":%u,\"ring_size\":%u,\"ring_used\":%u"
+          ",\"ring_dropped\":%u,\"processes_watched\":%u,\"processes_truncated\":%s,\"threads_truncated\":%s"
+          ",\"processes\":[",
+          m.free_user, m.free_cdram, m.free_phycont, m.ring_size, m.ring_used, m.ring_dropped, m.processes_watched,
+          m.flags & CATLOG_METRICS_PROCESSES_TRUNCATED ? "true" : "false",
+          m.flags & CATLOG_METRICS_THREADS_TRUNCATED ? "true" : "false");
+
+  for (unsigned i = 0; i < m.process_count; i++, p += sizeof(CatLogMetricsProcess_t))
+  {
+    CatLogMetricsProcess_t proc;
+    memcpy(&proc, p, sizeof(proc));
+    fprintf(out, "%s{\"pid\":\"0x%08x\",\"threads\":%u,\"run_time\":%" PRIu64 "}", i ? "," : "", proc.pid,
+            proc.threads, proc.run_time);
+  }
+
+  fputs("],\"threads\":[", out);
+
+  for (unsigned i = 0; i < m.thread_count; i++, p += sizeof(CatLogMetricsThread_t))
+  {
+    CatLogMetricsThread_t t;
+    memcpy(&t, p, sizeof(t));
+    fprintf(out, "%s{\"pid\":\"0x%08x\",\"thid\":\"0x%08x\",\"name\":", i ? "," : "", t.pid, t.thid);
+    json_string(out, t.name, strnlen(t.name, sizeof(t.name)));
+    fprintf(out, ",\"run_time\":%" PRIu64 "}", t.run_time);
+  }
+
+  fputc(']', out);
+  return 0;
+}
+
+static void decode(const CatLogRecord_t *rec)
+{
+  uint16_t size;
+  const char *payload = CatLogRecordPayload(rec, &size);
+  size_t len          = size;
+
+  if (rec->type == CATLOG_RECORD_HELLO)
+    return;
+
+  printf("{\"time\":%" PRIu64 ",\"pid\":\"0x%08x\",\"thid\":\"0x%08x\",\"cpu\":%u,\"source\":\"%s\",\"level\":\"%s\"",
+         rec->time, rec->pid, rec->thid, rec->cpu,
+         (rec->flags & CATLOG_FLAG_SOURCE_MASK) == CATLOG_SOURCE_KERNEL ? "kernel" : "user",
+         record_level_name(rec->level));
+
+  if (payload != (const char *)(rec + 1))
+  {
+    CatLogCaller_t c;
+    memcpy(&c, rec + 1, sizeof(c));
+    printf(",\"caller\":{\"addr\":\"0x%08x\",\"modid\":\"0x%08x\",\"segment\":%u,\"offset\":\"0x%x\"}", c.addr,
+           c.modid, c.segment, c.offset);
+  }
+
+  switch (rec->type)
+  {
+  case CATLOG_RECORD_TEXT:
+    if (len > 0 && payload[len - 1] == '\n')
+      len--;
+    fputs(",\"type\":\"text\",\"text\":", stdout);
+    json_string(stdout, payload, len);
+    break;
+  case CATLOG_RECORD_EVENT:
+  {
+    fputs(",\"type\":\"event\"", stdout);
+    // rendered aside so a malformed event can't leave half an object behind
+    char *json      = NULL;
+    size_t json_len = 0;
+    FILE *out       = open_memstream(&json, &json_len);
+    if (out && decode_event(out, payload, len) == 0 && fflush(out) == 0)
+      fwrite(json, 1, json_len, stdout);
+    else
+      fputs(",\"error\":\"malformed event\"", stdout);
+    if (out)
+      fclose(out);
+    free(json);
+    break;
+  }
+  case CATLOG_RECORD_STATS:
+  {
+    CatLogStats_t st;
+    if (len < sizeof(st))
+    {
+      fputs(",\"type\":\"stats\",\"error\":\"short record\"", stdout);
+      break;
+    }
+    memcpy(&st, payload, sizeof(st));
+    printf(",\"type\":\"stats\",\"ring_size\":%u,\"ring_used\":%u,\"ring_dropped\":%u,\"ring_filtered\":%u"
+           ",\"channels\":%u,\"channel_dropped\":%u,\"bytes_sent\":%" PRIu64,
+           st.ring_size, st.ring_used, st.ring_dropped, st.ring_filtered, st.channels, st.channel_dropped,
+           st.bytes_sent);
+    break;
+  }
+  case CATLOG_RECORD_METRICS:
+  {
+    fputs(",\"type\":\"metrics\"", stdout);
+    char *json      = NULL;
+    size_t json_len = 0;
+    FILE *out       = open_memstream(&json, &json_len);
+    if (out && decode_metrics(out, payload, len) == 0 && fflush(out) == 0)
+      fwrite(json, 1, json_len, stdout);
+    else
+      fputs(",\"error\":\"malformed metrics\"", stdout);
+    if (out)
+      fclose(out);
+    free(json);
+    break;
+  }
+  case CATLOG_RECORD_TRACE:
+  {
+    CatLogTrace_t t;
+    if (len < sizeof(t))
+    {
+      fputs(",\"type\":\"trace\",\"error\":\"short record\"", stdout);
+      break;
+    }
+    memcpy(&t, payload, sizeof(t));
+    printf(",\"type\":\"trace\",\"phase\":\"%c\",\"name\":", t.phase);
+    json_string(stdout, t.name, strnlen(t.name, sizeof(t.name)));
+    if (t.phase == CATLOG_TRACE_COUNTER)
+      printf(",\"value\":%" PRId64, t.value);
+    break;
+  }
+  case CATLOG_RECORD_MODULE:
+  {
+    CatLogModule_t m;
+    if (len < sizeof(m))
+    {
+      fputs(",\"type\":\"module\",\"error\":\"short record\"", stdout);
+      break;
+    }
+    memcpy(&m, payload, sizeof(m));
+    printf(",\"type\":\"module\",\"modid\":\"0x%08x\",\"nid\":\"0x%08x\",\"name\":", m.modid, m.module_nid);
+    json_string(stdout, m.name, strnlen(m.name, sizeof(m.name)));
+    fputs(",\"segments\":[", stdout);
+    for (int i = 0; i < 4 && m.seg_size[i]; i++)
+      printf("%s{\"base\":\"0x%08x\",\"size\":%u}", i ? "," : "", m.seg_base[i], m.seg_size[i]);
+    fputc(']', stdout);
+    break;
+  }
+  default:
+    printf(",\"type\":%u,\"size\":%zu", rec->type, len);
+    break;
+  }
+
+  puts("}");
+}
+
+int main(int argc, char *argv[])
+{
+  int ret = 0;
+
+  for (int i = 1; i < argc || i == 1; i++)
+  {
+    FILE *fp = stdin;
+    if (i < argc && strcmp(argv[i], "-") != 0)
+    {
+      fp = fopen(argv[i], "rb");
+      if (!fp)
+      {
+        perror(argv[i]);
+        ret = 1;
+        continue;
+      }
+    }
+
+    reader_t r;
+    if (reader_open(&r, fp) < 0)
+      return 1;
+
+    const CatLogRecord_t *rec;
+    while ((rec = reader_next(&r)) != NULL)
+      decode(rec);
+
+    reader_close(&r);
+    if (fp != stdin)
+      fclose(fp);
+  }
+
+  return ret;
+}
@@ -0,0 +1,119 @@
+/*
+CatLog
+Copyright (C) 2024 Cat
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// catlog-query - looks records up in a capture store written by catlogd.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "store.h"
+
+static void usage(const char *argv0)
+{
+  fprintf(stderr,
+          "usage: %s [-p pid] [-s kernel|user] [-f from] [-t to] [-r] <store dir>\n"
+          "  -p pid     only records of this process id (hex or decimal)\n"
+          "  -s source  only kernel or user records\n"
+          "  -f from    start time, device microseconds\n"
+          "  -t to      end time, device microseconds\n"
+          "  -r         write matching records in the framed format instead of text\n",
+          argv0);
+}
+
+static int print_text(const CatLogRecord_t *rec, void *arg)
+{
+  (void)arg;
+
+  if (rec->type != CATLOG_RECORD_TEXT)
+    return 0;
+
+  uint16_t len;
+  const char *text = CatLogRecordPayload(rec, &len);
+  if (len > 0 && text[len - 1] == '\n')
+    len--;
+
+  printf("%llu.%06llu %08x %c %.*s\n", (unsigned long long)(rec->time / 1000000),
+         (unsigned long long)(rec->time % 1000000), rec->pid,
+         (rec->flags & CATLOG_FLAG_SOURCE_MASK) == CATLOG_SOURCE_KERNEL ? 'K' : 'U', len, text);
+  return 0;
+}
+
+static int print_raw(const CatLogRecord_t *rec, void *arg)
+{
+  (void)arg;
+  return fwrite(rec, sizeof(*rec) + rec->size, 1, stdout) == 1 ? 0 : 1;
+}
+
+int main(int argc, char *argv[])
+{
+  store_query_t q = {0, UINT64_MAX, -1, 0, 0};
+  int raw         = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "p:s:f:t:rh")) != -1)
+  {
+    switch (opt)
+    {
+    case 'p':
+      q.pid = strtoll(optarg, NULL, 0);
+      break;
+    case 's':
+      if (strcmp(optarg, "kernel") == 0)
+        q.sources = 1u << CATLOG_SOURCE_KERNEL;
+      else if (strcmp(optarg, "user") == 0)
+        q.sources = 1u << CATLOG_SOURCE_USER;
+      else
+      {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'f':
+      q.time_min = strtoull(optarg, NULL, 0);
+      break;
+    case 't':
+      q.time_max = strtoull(optarg, NULL, 0);
+      break;
+    case 'r':
+      raw = 1;
+      break;
+    default:
+      usage(argv[0]);
+      return opt == 'h' ? 0 : 1;
+    }
+  }
+
+  if (optind >= argc)
+  {
+    usage(argv[0]);
+    return 1;
+  }
+
+  if (!raw)
+    q.types = 1u << CATLOG_RECORD_TEXT;
+
+  if (store_query(argv[optind], &q, raw ? print_raw : print_text, NULL) < 0)
+  {
+    perror(argv[optind]);
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,507 @@
+/*
+CatLog
+Copyright (C) 2024 Cat
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+// catlog-symbolize - maps record callers (CATLOG_FLAG_CALLER) to module symbols.
+// Prints the code locations producing the most records, or with -f passes on
+// only the records logged from one module or function.
+
+#define _GNU_SOURCE
+
+#include <elf.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "reader.h"
+
+#define DEFAULT_TOP 20
+
+typedef struct {
+  uint32_t segment;
+  uint32_t offset;
+  char *name;
+} symbol_t;
+
+// symbols of one module, by module name
+typedef struct {
+  char *module;
+  symbol_t *syms;
+  size_t count;
+  size_t cap;
+} symtab_t;
+
+typedef struct {
+  uint32_t pid;
+  uint32_t modid;
+  char name[sizeof(((CatLogModule_t *)0)->name) + 1];
+} module_t;
+
+typedef struct {
+  char *where;
+  uint64_t count;
+  uint64_t bytes;
+} talker_t;
+
+static symtab_t *tabs;
+static size_t tab_count;
+
+static module_t *modules;
+static size_t module_count;
+
+static talker_t *talkers;
+static size_t talker_count;
+static size_t talker_cap; // power of two
+
+static void usage(const char *argv0)
+{
+  fprintf(stderr,
+          "usage: %s [-e module=file.elf] [-m module=file.map] [-n count] [-f module[!symbol] [-v]] [file...]\n"
+          "  -e module=elf  symbols from an unstripped ELF of the module\n"
+          "  -m module=map  symbols from a text map, one \"[segment:]offset name\" per line (hex offsets)\n"
+          "  -n count       locations to list (default %d)\n"
+          "  -f location    write only the framed records logged from this module or function\n"
+          "  -v             with -f, write the records not logged from there instead\n"
+          "Input is a framed stream, e.g. catlog-query -r output.\n",
+          argv0, DEFAULT_TOP);
+}
+
+static void *xrealloc(void *p, size_t size)
+{
+  p = realloc(p, size);
+  if (!p)
+  {
+    perror("catlog-symbolize");
+    exit(1);
+  }
+  return p;
+}
+
+static symtab_t *symtab_get(const char *module)
+{
+  for (size_t i = 0; i < tab_count; i++)
+  {
+    if (strcmp(tabs[i].module, module) == 0)
+      return &tabs[i];
+  }
+
+  tabs = xrealloc(tabs, (tab_count + 1) * sizeof(*tabs));
+  symtab_t *t = &tabs[tab_count++];
+  memset(t, 0, sizeof(*t));
+  t->module = strdup(module);
+  return t;
+}
+
+static void symtab_add(symtab_t *t, uint32_t segment, uint32_t offset, const char *name)
+{
+  if (t->count == t->cap)
+  {
+    t->cap  = t->cap ? t->cap * 2 : 256;
+    t->syms = xrealloc(t->syms, t->cap * sizeof(*t->syms));
+  }
+  t->syms[t->count++] = (symbol_t){segment, offset, strdup(name)};
+}
+
+static int symbol_cmp(const void *a, const void *b)
+{
+  const symbol_t *x = a;
+  const symbol_t *y = b;
+  if (x->segment != y->segment)
+    return x->segment < y->segment ? -1 : 1;
+  return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+// nearest symbol at or below the offset
+static const symbol_t *symtab_find(const symtab_t *t, uint32_t segment, uint32_t offset)
+{
+  const symbol_t *best = NULL;
+  size_t lo            = 0;
+  size_t hi            = t->count;
+
+  while (lo < hi)
+  {
+    size_t mid          = (lo + hi) / 2;
+    const symbol_t *sym = &t->syms[mid];
+    if (sym->segment < segment || (sym->segment == segment && sym->offset <= offset))
+    {
+      if (sym->segment == segment)
+        best = sym;
+      lo = mid + 1;
+    }
+    else
+    {
+      hi = mid;
+    }
+  }
+
+  return best;
+}
+
+static int load_map(symtab_t *t, const char *path)
+{
+  FILE *fp = fopen(path, "r");
+  if (!fp)
+    return -1;
+
+  char line[1024];
+  while (fgets(line, sizeof(line), fp))
+  {
+    unsigned int segment = 0;
+    unsigned int offset;
+    char name[512];
+
+    if (sscanf(line, "%x:%x %511s", &segment, &offset, name) == 3 ||
+        (segment = 0, sscanf(line, "%x %511s", &offset, name) == 2))
+      symtab_add(t, segment, offset, name);
+  }
+
+  fclose(fp);
+  return 0;
+}
+
+// segment n of a module is its n-th PT_LOAD
+static int load_elf(symtab_t *t, const char *path)
+{
+  int ret = -1;
+  struct stat st;
+  char *map = MAP_FAILED;
+
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0 || fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(Elf32_Ehdr))
+    goto end;
+
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED)
+    goto end;
+
+  const Elf32_Ehdr *eh = (const Elf32_Ehdr *)map;
+  if (memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0 || eh->e_ident[EI_CLASS] != ELFCLASS32 ||
+      eh->e_phoff + (uint64_t)eh->e_phnum * sizeof(Elf32_Phdr) > (uint64_t)st.st_size ||
+      eh->e_shoff + (uint64_t)eh->e_shnum * sizeof(Elf32_Shdr) > (uint64_t)st.st_size)
+    goto end;
+
+  uint32_t seg_base[4] = {0};
+  uint32_t seg_size[4] = {0};
+  int segs             = 0;
+  const Elf32_Phdr *ph = (const Elf32_Phdr *)(map + eh->e_phoff);
+  for (int i = 0; i < eh->e_phnum && segs < 4; i++)
+  {
+    if (ph[i].p_type == PT_LOAD)
+    {
+      seg_base[segs] = ph[i].p_vaddr;
+      seg_size[segs] = ph[i].p_memsz;
+      segs++;
+    }
+  }
+
+  const Elf32_Shdr *sh = (const Elf32_Shdr *)(map + eh->e_shoff);
+  for (int i = 0; i < eh->e_shnum; i++)
+  {
+    if (sh[i].sh_type != SHT_SYMTAB || sh[i].sh_link >= eh->e_shnum)
+      continue;
+
+    const Elf32_Shdr *strtab = &sh[sh[i].sh_link];
+    if (sh[i].sh_offset + (uint64_t)sh[i].sh_size > (uint64_t)st.st_size ||
+        strtab->sh_offset + (uint64_t)strtab->sh_size > (uint64_t)st.st_size)
+      continue;
+
+    const Elf32_Sym *syms = (const Elf32_Sym *)(map + sh[i].sh_offset);
+    size_t count          = sh[i].sh_size / sizeof(Elf32_Sym);
+
+    for (size_t j = 0; j < count; j++)
+    {
+      int type = ELF32_ST_TYPE(syms[j].st_info);
+      if ((type != STT_FUNC && type != STT_OBJECT) || syms[j].st_name >= strtab->sh_size)
+        continue;
+
+      uint32_t value = syms[j].st_value & ~1u; // thumb bit
+      for (int s = 0; s < segs; s++)
+      {
+        if (value - seg_base[s] < seg_size[s])
+        {
+          symtab_add(t, s, value - seg_base[s], map + strtab->sh_offset + syms[j].st_name);
+          break;
+        }
+      }
+    }
+  }
+
+  ret = 0;
+
+end:
+  if (map != MAP_FAILED)
+    munmap(map, st.st_size);
+  if (fd >= 0)
+    close(fd);
+  return ret;
+}
+
+static const char *module_name(uint32_t pid, uint32_t modid)
+{
+  for (size_t i = 0; i < module_count; i++)
+  {
+    if (modules[i].pid == pid && modules[i].modid == modid)
+      return modules[i].name;
+  }
+  return NULL;
+}
+
+static void module_add(const CatLogRecord_t *rec)
+{
+  CatLogModule_t m;
+  if (rec->size < sizeof(m))
+    return;
+  memcpy(&m, rec + 1, sizeof(m));
+
+  module_t *dst = NULL;
+  for (size_t i = 0; i < module_count && !dst; i++)
+  {
+    if (modules[i].pid == rec->pid && modules[i].modid == m.modid)
+      dst = &modules[i];
+  }
+  if (!dst)
+  {
+    modules = xrealloc(modules, (module_count + 1) * sizeof(*modules));
+    dst     = &modules[module_count++];
+  }
+
+  dst->pid   = rec->pid;
+  dst->modid = m.modid;
+  memcpy(dst->name, m.name, sizeof(m.name));
+  dst->name[sizeof(m.name)] = 0;
+}
+
+// "module!symbol" (or "module:segment+offset" without symbols) of a record's caller
+static void locate(const CatLogRecord_t *rec, char *module, size_t module_len, char *where, size_t where_len)
+{
+  CatLogCaller_t c;
+  memcpy(&c, rec + 1, sizeof(c));
+
+  const char *name = c.modid ? module_name(rec->pid, c.modid) : NULL;
+  if (!name)
+  {
+    snprintf(module, module_len, "?");
+    snprintf(where, where_len, "?!0x%08x", c.addr);
+    return;
+  }
+  snprintf(module, module_len, "%s", name);
+
+  const symtab_t *t   = NULL;
+  const symbol_t *sym = NULL;
+  for (size_t i = 0; i < tab_count && !t; i++)
+  {
+    if (strcmp(tabs[i].module, name) == 0)
+      t = &tabs[i];
+  }
+  if (t)
+    sym = symtab_find(t, c.segment, c.offset);
+
+  if (sym)
+    snprintf(where, where_len, "%s!%s", name, sym->name);
+  else
+    snprintf(where, where_len, "%s:%u+0x%x", name, c.segment, c.offset);
+}
+
+static size_t hash(const char *s)
+{
+  size_t h = 0;
+  while (*s)
+    h = h * 31 + (unsigned char)*s++;
+  return h;
+}
+
+static talker_t *talker_get(const char *where)
+{
+  if (talker_count * 2 >= talker_cap)
+  {
+    size_t cap     = talker_cap ? talker_cap * 2 : 1024;
+    talker_t *grow = calloc(cap, sizeof(*grow));
+    if (!grow)
+    {
+      perror("catlog-symbolize");
+      exit(1);
+    }
+    for (size_t i = 0; i < talker_cap; i++)
+    {
+      if (!talkers[i].where)
+        continue;
+      size_t h = hash(talkers[i].where);
+      while (grow[h & (cap - 1)].where)
+        h++;
+      grow[h & (cap - 1)] = talkers[i];
+    }
+    free(talkers);
+    talkers    = grow;
+    talker_cap = cap;
+  }
+
+  for (size_t h = hash(where);; h++)
+  {
+    talker_t *t = &talkers[h & (talker_cap - 1)];
+    if (!t->where)
+    {
+      t->where = strdup(where);
+      talker_count++;
+      return t;
+    }
+    if (strcmp(t->where, where) == 0)
+      return t;
+  }
+}
+
+static int talker_cmp(const void *a, const void *b)
+{
+  const talker_t *x = a;
+  const talker_t *y = b;
+  return x->count < y->count ? 1 : x->count > y->count ? -1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+  int top            = DEFAULT_TOP;
+  const char *filter = NULL;
+  int invert         = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "e:m:n:f:vh")) != -1)
+  {
+    char *eq;
+    switch (opt)
+    {
+    case 'e':
+    case 'm':
+      eq = strchr(optarg, '=');
+      if (!eq)
+      {
+        usage(argv[0]);
+        return 1;
+      }
+      *eq = 0;
+      if ((opt == 'e' ? load_elf : load_map)(symtab_get(optarg), eq + 1) < 0)
+      {
+        fprintf(stderr, "catlog-symbolize: can't load %s\n", eq + 1);
+        return 1;
+      }
+      break;
+    case 'n':
+      top = atoi(optarg);
+      break;
+    case 'f':
+      filter = optarg;
+      break;
+    case 'v':
+      invert = 1;
+      break;
+    default:
+      usage(argv[0]);
+      return opt == 'h' ? 0 : 1;
+    }
+  }
+
+  for (size_t i = 0; i < tab_count; i++)
+    qsort(tabs[i].syms, tabs[i].count, sizeof(symbol_t), symbol_cmp);
+
+  uint64_t total   = 0;
+  uint64_t located = 0;
+
+  for (int i = optind; i < argc || i == optind; i++)
+  {
+    FILE *fp = stdin;
+    if (i < argc && strcmp(argv[i], "-") != 0)
+    {
+      fp = fopen(argv[i], "rb");
+      if (!fp)
+      {
+        perror(argv[i]);
+        return 1;
+      }
+    }
+
+    reader_t r;
+    if (reader_open(&r, fp) < 0)
+      return 1;
+
+    const CatLogRecord_t *rec;
+    while ((rec = reader_next(&r)) != NULL)
+    {
+      int has_caller = (rec->flags & CATLOG_FLAG_CALLER) && rec->size >= sizeof(CatLogCaller_t);
+      char module[64];
+      char where[640];
+
+      if (rec->type == CATLOG_RECORD_MODULE)
+        module_add(rec);
+
+      if (filter)
+      {
+        int match = 0;
+        if (has_caller)
+        {
+          locate(rec, module, sizeof(module), where, sizeof(where));
+          match = strcmp(module, filter) == 0 || strcmp(where, filter) == 0;
+        }
+        // keep the stream decodable and symbolizable
+        if (rec->type == CATLOG_RECORD_HELLO || rec->type == CATLOG_RECORD_MODULE || match != invert)
+          fwrite(rec, sizeof(*rec) + rec->size, 1, stdout);
+        continue;
+      }
+
+      if (rec->type == CATLOG_RECORD_HELLO || rec->type == CATLOG_RECORD_MODULE)
+        continue;
+
+      total++;
+      if (!has_caller)
+        continue;
+
+      located++;
+      locate(rec, module, sizeof(module), where, sizeof(where));
+      talker_t *t = talker_get(where);
+      t->count++;
+      t->bytes += rec->size - sizeof(CatLogCaller_t);
+    }
+
+    reader_close(&r);
+    if (fp != stdin)
+      fclose(fp);
+  }
+
+  if (filter)
+    return 0;
+
+  // compact and sort by record count
+  size_t n = 0;
+  for (size_t i = 0; i < talker_cap; i++)
+  {
+    if (talkers[i].where)
+      talkers[n++] = talkers[i];
+  }
+  qsort(talkers, n, sizeof(*talkers), talker_cmp);
+
+  printf("%" PRIu64 " records, %" PRIu64 " with caller\n", total, located);
+  printf("%10s %7s %12s  %s\n", "records", "share", "bytes", "location");
+  for (size_t i = 0; i < n && (int)i < top; i++)
+  {
+    printf("%10" PRIu64 " %6.2f%% %12" PRIu64 "  %s\n", talkers[i].count,
+           located ? 100.0 * talkers[i].count / located : 0.0, talkers[i].bytes, talkers[i].where);
+  }
+
+  return 0;
+}
@@ -0,0 +1,212 @@
+/*
+CatLog
+Copyright (C) 2024 Cat
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+// catlog-trace - turns the trace events of a framed stream into the Chrome trace event format.
+// The JSON loads in chrome://tracing and in the Perfetto UI.
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "reader.h"
+
+#define CPU_TRACKED 16
+
+static int first = 1;
+
+// previous sample per process, CPU load is the run time difference between two
+static struct {
+  uint32_t pid;
+  uint64_t run_time;
+  uint64_t time;
+} cpu_last[CPU_TRACKED];
+static int cpu_next;
+
+static void usage(const char *argv0)
+{
+  fprintf(stderr,
+          "usage: %s [-l] [file...]\n"
+          "  -l  add log lines as instant events\n"
+          "Metrics records become memory, ring and per-process CPU counters.\n"
+          "Input is a framed stream, e.g. catlog-query -r output.\n",
+          argv0);
+}
+
+static void event_start(const CatLogRecord_t *rec, char phase, const char *name, size_t name_len)
+{
+  printf("%s\n{\"name\":", first ? "" : ",");
+  first = 0;
+  json_string(stdout, name, name_len);
+  printf(",\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%" PRIu64 ",\"pid\":%u,\"tid\":%u",
+         (rec->flags & CATLOG_FLAG_SOURCE_MASK) == CATLOG_SOURCE_KERNEL ? "kernel" : "user", phase, rec->time,
+         rec->pid, rec->thid);
+}
+
+static void trace(const CatLogRecord_t *rec)
+{
+  CatLogTrace_t t;
+  uint16_t len;
+  const char *payload = CatLogRecordPayload(rec, &len);
+
+  if (len < sizeof(t))
+    return;
+  memcpy(&t, payload, sizeof(t));
+
+  switch (t.phase)
+  {
+  case CATLOG_TRACE_BEGIN:
+  case CATLOG_TRACE_END:
+    event_start(rec, t.phase, t.name, strnlen(t.name, sizeof(t.name)));
+    printf(",\"args\":{\"cpu\":%u}}", rec->cpu);
+    break;
+  case CATLOG_TRACE_COUNTER:
+    event_start(rec, t.phase, t.name, strnlen(t.name, sizeof(t.name)));
+    printf(",\"args\":{\"value\":%" PRId64 "}}", t.value);
+    break;
+  case CATLOG_TRACE_INSTANT:
+    event_start(rec, t.phase, t.name, strnlen(t.name, sizeof(t.name)));
+    printf(",\"s\":\"t\",\"args\":{\"cpu\":%u}}", rec->cpu);
+    break;
+  }
+}
+
+static void cpu_counter(const CatLogRecord_t *rec, const CatLogMetricsProcess_t *proc)
+{
+  int i;
+  for (i = 0; i < CPU_TRACKED && cpu_last[i].pid != proc->pid; i++)
+    ;
+
+  if (i < CPU_TRACKED && rec->time > cpu_last[i].time)
+  {
+    // run time sums all threads, on four cores this can exceed 100
+    double load = 100.0 * (proc->run_time - cpu_last[i].run_time) / (rec->time - cpu_last[i].time);
+    char name[32];
+    int name_len = snprintf(name, sizeof(name), "cpu %% 0x%08x", proc->pid);
+    event_start(rec, 'C', name, name_len);
+    printf(",\"args\":{\"load\":%.1f}}", load);
+  }
+  else if (i == CPU_TRACKED)
+  {
+    i        = cpu_next;
+    cpu_next = (cpu_next + 1) % CPU_TRACKED;
+  }
+
+  cpu_last[i].pid      = proc->pid;
+  cpu_last[i].run_time = proc->run_time;
+  cpu_last[i].time     = rec->time;
+}
+
+static void metrics(const CatLogRecord_t *rec)
+{
+  CatLogMetrics_t m;
+  uint16_t len;
+  const char *payload = CatLogRecordPayload(rec, &len);
+
+  if (len < sizeof(m))
+    return;
+  memcpy(&m, payload, sizeof(m));
+  if (len - sizeof(m) < m.process_count * sizeof(CatLogMetricsProcess_t))
+    return;
+
+  event_start(rec, 'C', "free memory", 11);
+  printf(",\"args\":{\"user\":%u,\"cdram\":%u,\"phycont\":%u}}", m.free_user, m.free_cdram, m.free_phycont);
+  event_start(rec, 'C', "ring", 4);
+  printf(",\"args\":{\"used\":%u,\"dropped\":%u}}", m.ring_used, m.ring_dropped);
+
+  for (unsigned i = 0; i < m.process_count; i++)
+  {
+    CatLogMetricsProcess_t proc;
+    memcpy(&proc, payload + sizeof(m) + i * sizeof(proc), sizeof(proc));
+    cpu_counter(rec, &proc);
+  }
+}
+
+static void text(const CatLogRecord_t *rec)
+{
+  uint16_t len;
+  const char *payload = CatLogRecordPayload(rec, &len);
+
+  if (len > 0 && payload[len - 1] == '\n')
+    len--;
+
+  event_start(rec, 'i', "log", 3);
+  fputs(",\"s\":\"t\",\"args\":{\"text\":", stdout);
+  json_string(stdout, payload, len);
+  printf(",\"level\":\"%s\"}}", record_level_name(rec->level));
+}
+
+int main(int argc, char *argv[])
+{
+  int logs = 0;
+  int ret  = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "lh")) != -1)
+  {
+    switch (opt)
+    {
+    case 'l':
+      logs = 1;
+      break;
+    default:
+      usage(argv[0]);
+      return opt == 'h' ? 0 : 1;
+    }
+  }
+
+  // timestamps are the console's system time in microseconds, Chrome's native unit
+  fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", stdout);
+
+  for (int i = optind; i < argc || i == optind; i++)
+  {
+    FILE *fp = stdin;
+    if (i < argc && strcmp(argv[i], "-") != 0)
+    {
+      fp = fopen(argv[i], "rb");
+      if (!fp)
+      {
+        perror(argv[i]);
+        ret = 1;
+        continue;
+      }
+    }
+
+    reader_t r;
+    if (reader_open(&r, fp) < 0)
+      return 1;
+
+    const CatLogRecord_t *rec;
+    while ((rec = reader_next(&r)) != NULL)
+    {
+      if (rec->type == CATLOG_RECORD_TRACE)
+        trace(rec);
+      else if (rec->type == CATLOG_RECORD_METRICS)
+        metrics(rec);
+      else if (logs && rec->type == CATLOG_RECORD_TEXT)
+        text(rec);
+    }
+
+    reader_close(&r);
+    if (fp != stdin)
+      fclose(fp);
+  }
+
+  fputs("\n]}\n", stdout);
+  return ret;
+}
@@ -0,0 +1,679 @@
+/*
+CatLog
+Copyright (C) 2024 Cat
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// catlogd - receives CatLog streams from many consoles at once.
+// Every device (keyed by its IPv4 address) gets its own capture file,
+// connections are multiplexed with epoll and output is written in large chunks.
+// Plain text streams go to <dir>/<ip>.log, framed streams to the indexed store in <dir>/<ip>/.
+// Commands from catlog-ctl arrive on <dir>/control.sock and are forwarded to framed connections.
+
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "control.h"
+#include "store.h"
+
+#define DEFAULT_PORT 9999
+#define DEFAULT_REPORT_INTERVAL 5
+#define DEVICE_BUF_LEN (1024 * 1024)
+#define DEVICE_HASH_LEN 1024
+#define MAX_EVENTS 256
+#define CONN_BUF_LEN (128 * 1024)
+
+enum
+{
+  SRC_LISTEN,
+  SRC_TIMER,
+  SRC_SIGNAL,
+  SRC_CONTROL,
+  SRC_CONN,
+};
+
+enum
+{
+  MODE_UNKNOWN,
+  MODE_TEXT,
+  MODE_FRAMED,
+};
+
+struct conn;
+
+typedef struct device
+{
+  struct device *next;
+  uint32_t addr;
+  int out_fd;
+  int conns;
+  struct conn *ctl; // latest framed connection, commands go there
+
+  char *buf;
+  size_t buf_len;
+
+  store_t *store;
+
+  uint64_t total;
+  uint64_t window;
+} device_t;
+
+typedef struct conn
+{
+  int src;
+  int fd;
+  device_t *dev;
+
+  int mode;
+  char *buf;
+  size_t buf_len;
+
+  uint8_t head[2]; // read before the mode is known
+  size_t head_len;
+} conn_t;
+
+static device_t *devices[DEVICE_HASH_LEN];
+static const char *out_dir = ".";
+static int epoll_fd        = -1;
+
+static conn_t listen_src = {.src = SRC_LISTEN, .fd = -1};
+static conn_t timer_src  = {.src = SRC_TIMER, .fd = -1};
+static conn_t signal_src = {.src = SRC_SIGNAL, .fd = -1};
+static conn_t control_src = {.src = SRC_CONTROL, .fd = -1};
+
+static void usage(const char *argv0)
+{
+  fprintf(stderr,
+          "usage: %s [-p port] [-o dir] [-i seconds]\n"
+          "  -p port     port to listen on (default %d)\n"
+          "  -o dir      directory for capture files (default .)\n"
+          "  -i seconds  ingest rate report interval, 0 disables (default %d)\n",
+          argv0, DEFAULT_PORT, DEFAULT_REPORT_INTERVAL);
+}
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+  while (len > 0)
+  {
+    ssize_t n = write(fd, buf, len);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+static void device_flush(device_t *dev)
+{
+  if (dev->store)
+    store_flush(dev->store);
+
+  if (dev->buf_len == 0)
+    return;
+
+  if (write_all(dev->out_fd, dev->buf, dev->buf_len) < 0)
+  {
+    struct in_addr in = {dev->addr};
+    fprintf(stderr, "catlogd: write failed for %s: %s\n", inet_ntoa(in), strerror(errno));
+  }
+  dev->buf_len = 0;
+}
+
+static unsigned int device_slot(uint32_t addr)
+{
+  return (ntohl(addr) * 2654435761u) % DEVICE_HASH_LEN;
+}
+
+static device_t *device_find(uint32_t addr)
+{
+  for (device_t *dev = devices[device_slot(addr)]; dev; dev = dev->next)
+  {
+    if (dev->addr == addr)
+      return dev;
+  }
+  return NULL;
+}
+
+static device_t *device_get(uint32_t addr)
+{
+  unsigned int slot = device_slot(addr);
+  device_t *dev     = device_find(addr);
+  if (dev)
+    return dev;
+
+  dev = calloc(1, sizeof(*dev));
+  if (!dev)
+    return NULL;
+
+  dev->buf = malloc(DEVICE_BUF_LEN);
+  if (!dev->buf)
+  {
+    free(dev);
+    return NULL;
+  }
+
+  char path[4096];
+  struct in_addr in = {addr};
+  snprintf(path, sizeof(path), "%s/%s.log", out_dir, inet_ntoa(in));
+
+  dev->out_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (dev->out_fd < 0)
+  {
+    fprintf(stderr, "catlogd: can't open %s: %s\n", path, strerror(errno));
+    free(dev->buf);
+    free(dev);
+    return NULL;
+  }
+
+  dev->addr     = addr;
+  dev->next     = devices[slot];
+  devices[slot] = dev;
+  return dev;
+}
+
+static void conn_close(conn_t *conn)
+{
+  epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+  close(conn->fd);
+  conn->dev->conns--;
+  if (conn->dev->ctl == conn)
+    conn->dev->ctl = NULL;
+  device_flush(conn->dev);
+  free(conn->buf);
+  free(conn);
+}
+
+static void on_accept(void)
+{
+  for (;;)
+  {
+    struct sockaddr_in peer;
+    socklen_t peer_len = sizeof(peer);
+
+    int fd = accept4(listen_src.fd, (struct sockaddr *)&peer, &peer_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0)
+    {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        fprintf(stderr, "catlogd: accept: %s\n", strerror(errno));
+      return;
+    }
+
+    int rcvbuf = 256 * 1024;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    conn_t *conn = calloc(1, sizeof(*conn));
+    device_t *dev = device_get(peer.sin_addr.s_addr);
+    if (!conn || !dev)
+    {
+      free(conn);
+      close(fd);
+      continue;
+    }
+
+    conn->src  = SRC_CONN;
+    conn->fd   = fd;
+    conn->dev  = dev;
+    conn->mode = MODE_UNKNOWN;
+
+    struct epoll_event ev = {.events = EPOLLIN | EPOLLRDHUP, .data.ptr = conn};
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+    {
+      free(conn);
+      close(fd);
+      continue;
+    }
+    dev->conns++;
+  }
+}
+
+static int conn_detect(conn_t *conn)
+{
+  device_t *dev = conn->dev;
+
+  // The bytes are consumed rather than peeked, a peer stopping after one byte would keep
+  // the level-triggered fd readable. EOF and errors decide with what has arrived, the
+  // mode's read path then sees them again and closes.
+  while (conn->head_len < sizeof(conn->head))
+  {
+    ssize_t n = read(conn->fd, conn->head + conn->head_len, sizeof(conn->head) - conn->head_len);
+    if (n > 0)
+    {
+      conn->head_len += n;
+      continue;
+    }
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return 0;
+    break;
+  }
+
+  dev->total += conn->head_len;
+  dev->window += conn->head_len;
+
+  if (conn->head_len == sizeof(conn->head) && (conn->head[0] | conn->head[1] << 8) == CATLOG_RECORD_MAGIC)
+  {
+    if (!dev->store)
+    {
+      char path[4096];
+      struct in_addr in = {dev->addr};
+      snprintf(path, sizeof(path), "%s/%s", out_dir, inet_ntoa(in));
+      dev->store = store_open(path);
+    }
+
+    conn->buf = malloc(CONN_BUF_LEN);
+    if (!dev->store || !conn->buf)
+    {
+      fprintf(stderr, "catlogd: can't open capture store\n");
+      return -1;
+    }
+    memcpy(conn->buf, conn->head, conn->head_len);
+    conn->buf_len = conn->head_len;
+    conn->mode    = MODE_FRAMED;
+    dev->ctl      = conn;
+  }
+  else
+  {
+    if (dev->buf_len + conn->head_len > DEVICE_BUF_LEN)
+      device_flush(dev);
+    memcpy(dev->buf + dev->buf_len, conn->head, conn->head_len);
+    dev->buf_len += conn->head_len;
+    conn->mode = MODE_TEXT;
+  }
+
+  return 1;
+}
+
+static void print_stats(const device_t *dev, const CatLogStats_t *st)
+{
+  struct in_addr in = {dev->addr};
+  fprintf(stderr,
+          "%-15s ring %u/%u bytes, %u dropped, %u filtered, %u channels (%u dropped), %llu bytes sent\n",
+          inet_ntoa(in), st->ring_used, st->ring_size, st->ring_dropped, st->ring_filtered, st->channels,
+          st->channel_dropped, (unsigned long long)st->bytes_sent);
+}
+
+static void conn_parse(conn_t *conn)
+{
+  size_t off = 0;
+
+  while (conn->buf_len - off >= sizeof(CatLogRecord_t))
+  {
+    const CatLogRecord_t *rec = (const CatLogRecord_t *)(conn->buf + off);
+    if (rec->magic != CATLOG_RECORD_MAGIC)
+    {
+      // lost sync, look for the next header
+      off++;
+      continue;
+    }
+
+    size_t len = sizeof(*rec) + rec->size;
+    if (conn->buf_len - off < len)
+      break;
+
+    store_append(conn->dev->store, rec);
+    if (rec->type == CATLOG_RECORD_STATS && rec->size >= sizeof(CatLogStats_t))
+      print_stats(conn->dev, (const CatLogStats_t *)(rec + 1));
+    off += len;
+  }
+
+  memmove(conn->buf, conn->buf + off, conn->buf_len - off);
+  conn->buf_len -= off;
+}
+
+static void on_readable_framed(conn_t *conn)
+{
+  device_t *dev = conn->dev;
+
+  for (;;)
+  {
+    ssize_t n = read(conn->fd, conn->buf + conn->buf_len, CONN_BUF_LEN - conn->buf_len);
+    if (n > 0)
+    {
+      conn->buf_len += n;
+      dev->total += n;
+      dev->window += n;
+      conn_parse(conn);
+      continue;
+    }
+
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return;
+
+    conn_close(conn);
+    return;
+  }
+}
+
+static void on_readable(conn_t *conn)
+{
+  device_t *dev = conn->dev;
+
+  if (conn->mode == MODE_UNKNOWN)
+  {
+    int ret = conn_detect(conn);
+    if (ret < 0)
+    {
+      conn_close(conn);
+      return;
+    }
+    if (ret == 0)
+      return;
+  }
+
+  if (conn->mode == MODE_FRAMED)
+  {
+    on_readable_framed(conn);
+    return;
+  }
+
+  // read straight into the device buffer, it only gets written out once full
+  for (;;)
+  {
+    if (dev->buf_len == DEVICE_BUF_LEN)
+      device_flush(dev);
+
+    ssize_t n = read(conn->fd, dev->buf + dev->buf_len, DEVICE_BUF_LEN - dev->buf_len);
+    if (n > 0)
+    {
+      dev->buf_len += n;
+      dev->total += n;
+      dev->window += n;
+      continue;
+    }
+
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return;
+
+    conn_close(conn);
+    return;
+  }
+}
+
+static void on_timer(int interval, int *elapsed)
+{
+  uint64_t expirations;
+  if (read(timer_src.fd, &expirations, sizeof(expirations)) < 0)
+    return;
+
+  *elapsed += (int)expirations;
+  int report = interval > 0 && *elapsed >= interval;
+
+  for (int i = 0; i < DEVICE_HASH_LEN; i++)
+  {
+    for (device_t *dev = devices[i]; dev; dev = dev->next)
+    {
+      device_flush(dev);
+
+      if (report && (dev->window || dev->conns))
+      {
+        struct in_addr in = {dev->addr};
+        fprintf(stderr, "%-15s %4d conn %10.1f KiB/s %12llu bytes\n", inet_ntoa(in), dev->conns,
+                dev->window / 1024.0 / *elapsed, (unsigned long long)dev->total);
+      }
+      if (report)
+        dev->window = 0;
+    }
+  }
+
+  if (report)
+    *elapsed = 0;
+}
+
+static void device_command(device_t *dev, const CatLogCommand_t *cmd)
+{
+  struct in_addr in = {dev->addr};
+
+  if (!dev->ctl)
+  {
+    fprintf(stderr, "catlogd: %s has no framed connection\n", inet_ntoa(in));
+    return;
+  }
+
+  // a few bytes on an otherwise receive-only socket, the send buffer never fills up
+  if (send(dev->ctl->fd, cmd, sizeof(*cmd), MSG_NOSIGNAL) != sizeof(*cmd))
+    fprintf(stderr, "catlogd: can't send command to %s: %s\n", inet_ntoa(in), strerror(errno));
+}
+
+static void on_control(void)
+{
+  control_msg_t msg;
+
+  for (;;)
+  {
+    ssize_t n = recv(control_src.fd, &msg, sizeof(msg), 0);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+    if (n != sizeof(msg) || msg.cmd.magic != CATLOG_COMMAND_MAGIC)
+      continue;
+
+    if (msg.addr != htonl(INADDR_ANY))
+    {
+      device_t *dev = device_find(msg.addr);
+      if (dev)
+        device_command(dev, &msg.cmd);
+      else
+        fprintf(stderr, "catlogd: command for unknown device %s\n", inet_ntoa((struct in_addr){msg.addr}));
+      continue;
+    }
+
+    for (int i = 0; i < DEVICE_HASH_LEN; i++)
+    {
+      for (device_t *dev = devices[i]; dev; dev = dev->next)
+      {
+        if (dev->ctl)
+          device_command(dev, &msg.cmd);
+      }
+    }
+  }
+}
+
+static int control_open(void)
+{
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/%s", out_dir, CONTROL_SOCKET) >= (int)sizeof(addr.sun_path))
+  {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  control_src.fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (control_src.fd < 0)
+    return -1;
+
+  unlink(addr.sun_path);
+  return bind(control_src.fd, (struct sockaddr *)&addr, sizeof(addr));
+}
+
+static void flush_all(void)
+{
+  for (int i = 0; i < DEVICE_HASH_LEN; i++)
+  {
+    for (device_t *dev = devices[i]; dev; dev = dev->next)
+      device_flush(dev);
+  }
+}
+
+static int add_source(conn_t *src)
+{
+  struct epoll_event ev = {.events = EPOLLIN, .data.ptr = src};
+  return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, src->fd, &ev);
+}
+
+int main(int argc, char *argv[])
+{
+  int port     = DEFAULT_PORT;
+  int interval = DEFAULT_REPORT_INTERVAL;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "p:o:i:h")) != -1)
+  {
+    switch (opt)
+    {
+    case 'p':
+      port = atoi(optarg);
+      break;
+    case 'o':
+      out_dir = optarg;
+      break;
+    case 'i':
+      interval = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+      return opt == 'h' ? 0 : 1;
+    }
+  }
+
+  mkdir(out_dir, 0755);
+
+  // one descriptor per device connection, make sure hundreds of them fit
+  struct rlimit nofile;
+  if (getrlimit(RLIMIT_NOFILE, &nofile) == 0)
+  {
+    nofile.rlim_cur = nofile.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &nofile);
+  }
+
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGINT);
+  sigaddset(&mask, SIGTERM);
+  sigprocmask(SIG_BLOCK, &mask, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd < 0)
+  {
+    perror("catlogd: epoll_create1");
+    return 1;
+  }
+
+  listen_src.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (listen_src.fd < 0)
+  {
+    perror("catlogd: socket");
+    return 1;
+  }
+
+  int one = 1;
+  setsockopt(listen_src.fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  struct sockaddr_in addr = {0};
+  addr.sin_family         = AF_INET;
+  addr.sin_addr.s_addr    = htonl(INADDR_ANY);
+  addr.sin_port           = htons(port);
+
+  if (bind(listen_src.fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listen_src.fd, SOMAXCONN) < 0)
+  {
+    perror("catlogd: bind");
+    return 1;
+  }
+
+  timer_src.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  struct itimerspec tick = {{1, 0}, {1, 0}};
+  timerfd_settime(timer_src.fd, 0, &tick, NULL);
+
+  signal_src.fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+
+  if (control_open() < 0 || add_source(&control_src) < 0)
+  {
+    perror("catlogd: control socket");
+    return 1;
+  }
+
+  if (add_source(&listen_src) < 0 || add_source(&timer_src) < 0 || add_source(&signal_src) < 0)
+  {
+    perror("catlogd: epoll_ctl");
+    return 1;
+  }
+
+  fprintf(stderr, "catlogd: listening on port %d, writing to %s\n", port, out_dir);
+
+  struct epoll_event events[MAX_EVENTS];
+  int elapsed = 0;
+  int run     = 1;
+
+  while (run)
+  {
+    int n = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      perror("catlogd: epoll_wait");
+      break;
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+      conn_t *src = events[i].data.ptr;
+      switch (src->src)
+      {
+      case SRC_LISTEN:
+        on_accept();
+        break;
+      case SRC_TIMER:
+        on_timer(interval, &elapsed);
+        break;
+      case SRC_SIGNAL:
+        run = 0;
+        break;
+      case SRC_CONTROL:
+        on_control();
+        break;
+      case SRC_CONN:
+        on_readable(src);
+        break;
+      }
+    }
+  }
+
+  flush_all();
+
+  return 0;
+}
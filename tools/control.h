@@ -0,0 +1,35 @@
+/*
+CatLog
+Copyright (C) 2024 Cat
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include "catlog_proto.h"
+
+#include <stdint.h>
+
+// catlog-ctl sends one control_msg_t datagram per command to catlogd's unix socket,
+// catlogd forwards the command on the device's framed connection.
+
+#define CONTROL_SOCKET "control.sock" // inside catlogd's output directory
+
+typedef struct {
+    uint32_t addr; // device IPv4 address in network order, INADDR_ANY for every device
+    CatLogCommand_t cmd;
+} __attribute__((packed)) control_msg_t;
+
+#endif
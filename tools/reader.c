@@ -0,0 +1,112 @@
+/*
+CatLog
+Copyright (C) 2024 Cat
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "reader.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// largest record plus a full read
+#define READER_BUF_LEN (256 * 1024)
+
+int reader_open(reader_t *r, FILE *fp)
+{
+  memset(r, 0, sizeof(*r));
+  r->fp  = fp;
+  r->buf = malloc(READER_BUF_LEN);
+  return r->buf ? 0 : -1;
+}
+
+const CatLogRecord_t *reader_next(reader_t *r)
+{
+  for (;;)
+  {
+    size_t avail = r->len - r->off;
+
+    if (avail >= sizeof(CatLogRecord_t))
+    {
+      const CatLogRecord_t *rec = (const CatLogRecord_t *)(r->buf + r->off);
+      if (rec->magic != CATLOG_RECORD_MAGIC)
+      {
+        // lost sync, look for the next header
+        r->off++;
+        continue;
+      }
+
+      size_t len = sizeof(*rec) + rec->size;
+      if (avail >= len)
+      {
+        r->off += len;
+        return rec;
+      }
+    }
+
+    memmove(r->buf, r->buf + r->off, avail);
+    r->len = avail;
+    r->off = 0;
+
+    size_t n = fread(r->buf + r->len, 1, READER_BUF_LEN - r->len, r->fp);
+    if (n == 0)
+      return NULL;
+    r->len += n;
+  }
+}
+
+void reader_close(reader_t *r)
+{
+  free(r->buf);
+  r->buf = NULL;
+}
+
+const char *record_level_name(int level)
+{
+  static const char *names[] = {"trace", "debug", "info", "warn", "error", "fatal"};
+  return level >= 0 && level < (int)(sizeof(names) / sizeof(names[0])) ? names[level] : "unknown";
+}
+
+void json_string(FILE *out, const char *s, size_t len)
+{
+  fputc('"', out);
+  for (size_t i = 0; i < len; i++)
+  {
+    unsigned char c = s[i];
+    switch (c)
+    {
+    case '"':
+      fputs("\\\"", out);
+      break;
+    case '\\':
+      fputs("\\\\", out);
+      break;
+    case '\n':
+      fputs("\\n", out);
+      break;
+    case '\r':
+      fputs("\\r", out);
+      break;
+    case '\t':
+      fputs("\\t", out);
+      break;
+    default:
+      if (c < 0x20)
+        fprintf(out, "\\u%04x", c);
+      else
+        fputc(c, out);
+    }
+  }
+  fputc('"', out);
+}
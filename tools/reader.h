@@ -0,0 +1,43 @@
+/*
+CatLog
+Copyright (C) 2024 Cat
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef READER_H
+#define READER_H
+
+#include "catlog_proto.h"
+
+#include <stdio.h>
+
+// Sequential reader for a framed stream (capture file, catlog-query -r output, ...).
+
+typedef struct {
+    FILE *fp;
+    char *buf;
+    size_t len;
+    size_t off;
+} reader_t;
+
+int reader_open(reader_t *r, FILE *fp);
+// payload follows the returned header, valid until the next call
+const CatLogRecord_t *reader_next(reader_t *r);
+void reader_close(reader_t *r);
+
+const char *record_level_name(int level);
+// writes s as a quoted and escaped JSON string
+void json_string(FILE *out, const char *s, size_t len);
+
+#endif
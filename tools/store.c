@@ -0,0 +1,385 @@
+/*
+CatLog
+Copyright (C) 2024 Cat
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include "store.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define STORE_BUF_LEN (1024 * 1024)
+
+struct store
+{
+  char dir[PATH_MAX];
+  unsigned int seg_no;
+  int seg_fd;
+  int idx_fd;
+  uint64_t seg_len;
+
+  char *buf;
+  size_t buf_len;
+
+  store_index_t cur;
+  store_index_t *idx_buf;
+  size_t idx_len;
+  size_t idx_cap;
+};
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+  const char *p = buf;
+  while (len > 0)
+  {
+    ssize_t n = write(fd, p, len);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+static int seg_filter(const struct dirent *de)
+{
+  size_t len = strlen(de->d_name);
+  return len > 4 && strcmp(de->d_name + len - 4, ".seg") == 0;
+}
+
+static void block_reset(store_t *st)
+{
+  memset(&st->cur, 0, sizeof(st->cur));
+  st->cur.offset   = st->seg_len;
+  st->cur.time_min = UINT64_MAX;
+}
+
+static int segment_open(store_t *st)
+{
+  char path[PATH_MAX + 16];
+  store_file_hdr_t hdr = {0};
+
+  snprintf(path, sizeof(path), "%s/%08u.seg", st->dir, st->seg_no);
+  st->seg_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (st->seg_fd < 0)
+    return -1;
+
+  snprintf(path, sizeof(path), "%s/%08u.idx", st->dir, st->seg_no);
+  st->idx_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (st->idx_fd < 0)
+  {
+    close(st->seg_fd);
+    return -1;
+  }
+
+  hdr.magic   = STORE_SEG_MAGIC;
+  hdr.version = STORE_VERSION;
+  write_all(st->seg_fd, &hdr, sizeof(hdr));
+
+  hdr.magic = STORE_IDX_MAGIC;
+  write_all(st->idx_fd, &hdr, sizeof(hdr));
+
+  st->seg_len = sizeof(hdr);
+  block_reset(st);
+  return 0;
+}
+
+static void block_seal(store_t *st)
+{
+  if (st->cur.count == 0)
+    return;
+
+  if (st->idx_len == st->idx_cap)
+  {
+    size_t cap          = st->idx_cap ? st->idx_cap * 2 : 64;
+    store_index_t *grow = realloc(st->idx_buf, cap * sizeof(*grow));
+    if (!grow)
+      return;
+    st->idx_buf = grow;
+    st->idx_cap = cap;
+  }
+
+  st->idx_buf[st->idx_len++] = st->cur;
+  block_reset(st);
+}
+
+static int data_flush(store_t *st)
+{
+  int ret = 0;
+
+  if (st->buf_len > 0)
+  {
+    ret         = write_all(st->seg_fd, st->buf, st->buf_len);
+    st->buf_len = 0;
+  }
+
+  // index entries only after the data they point to
+  if (st->idx_len > 0)
+  {
+    if (write_all(st->idx_fd, st->idx_buf, st->idx_len * sizeof(*st->idx_buf)) < 0)
+      ret = -1;
+    st->idx_len = 0;
+  }
+
+  return ret;
+}
+
+store_t *store_open(const char *dir)
+{
+  store_t *st = calloc(1, sizeof(*st));
+  if (!st)
+    return NULL;
+
+  snprintf(st->dir, sizeof(st->dir), "%s", dir);
+  mkdir(st->dir, 0755);
+
+  // never append to an old segment, its tail may not be indexed
+  struct dirent **list;
+  int n = scandir(st->dir, &list, seg_filter, alphasort);
+  if (n > 0)
+  {
+    st->seg_no = strtoul(list[n - 1]->d_name, NULL, 10) + 1;
+    for (int i = 0; i < n; i++)
+      free(list[i]);
+    free(list);
+  }
+
+  st->buf = malloc(STORE_BUF_LEN);
+  if (!st->buf || segment_open(st) < 0)
+  {
+    free(st->buf);
+    free(st);
+    return NULL;
+  }
+
+  return st;
+}
+
+int store_append(store_t *st, const CatLogRecord_t *rec)
+{
+  size_t len = sizeof(*rec) + rec->size;
+
+  if (st->cur.count > 0 && st->cur.length + len > STORE_BLOCK_LEN)
+  {
+    block_seal(st);
+  }
+
+  if (st->seg_len + len > STORE_SEGMENT_LEN && st->seg_len > sizeof(store_file_hdr_t))
+  {
+    block_seal(st);
+    data_flush(st);
+    close(st->seg_fd);
+    close(st->idx_fd);
+    st->seg_no++;
+    if (segment_open(st) < 0)
+      return -1;
+  }
+
+  if (st->buf_len + len > STORE_BUF_LEN)
+  {
+    if (data_flush(st) < 0)
+      return -1;
+  }
+
+  memcpy(st->buf + st->buf_len, rec, len);
+  st->buf_len += len;
+  st->seg_len += len;
+
+  store_index_t *b = &st->cur;
+  b->length += len;
+  b->count++;
+  b->time_min = rec->time < b->time_min ? rec->time : b->time_min;
+  b->time_max = rec->time > b->time_max ? rec->time : b->time_max;
+  b->pid_bloom |= store_pid_bit(rec->pid);
+  b->sources |= 1u << (rec->flags & CATLOG_FLAG_SOURCE_MASK);
+  b->types |= 1u << (rec->type & 31);
+
+  return 0;
+}
+
+int store_flush(store_t *st)
+{
+  block_seal(st);
+  return data_flush(st);
+}
+
+void store_close(store_t *st)
+{
+  if (!st)
+    return;
+
+  store_flush(st);
+  close(st->seg_fd);
+  close(st->idx_fd);
+  free(st->idx_buf);
+  free(st->buf);
+  free(st);
+}
+
+static int record_match(const CatLogRecord_t *rec, const store_query_t *q)
+{
+  if (rec->time < q->time_min || rec->time > q->time_max)
+    return 0;
+  if (q->pid >= 0 && rec->pid != (uint32_t)q->pid)
+    return 0;
+  if (q->sources && !(q->sources & (1u << (rec->flags & CATLOG_FLAG_SOURCE_MASK))))
+    return 0;
+  if (q->types && !(q->types & (1u << (rec->type & 31))))
+    return 0;
+  return 1;
+}
+
+static int block_match(const store_index_t *b, const store_query_t *q)
+{
+  if (b->time_max < q->time_min || b->time_min > q->time_max)
+    return 0;
+  if (q->pid >= 0 && !(b->pid_bloom & store_pid_bit(q->pid)))
+    return 0;
+  if (q->sources && !(b->sources & q->sources))
+    return 0;
+  if (q->types && !(b->types & q->types))
+    return 0;
+  return 1;
+}
+
+// walks records in [start, end), returns the offset where parsing stopped
+static uint64_t scan_range(const char *base, uint64_t start, uint64_t end, const store_query_t *q,
+                           store_visit_fn fn, void *arg, int *stop)
+{
+  uint64_t off = start;
+
+  while (!*stop && off + sizeof(CatLogRecord_t) <= end)
+  {
+    const CatLogRecord_t *rec = (const CatLogRecord_t *)(base + off);
+    if (rec->magic != CATLOG_RECORD_MAGIC || off + sizeof(*rec) + rec->size > end)
+      break;
+
+    if (record_match(rec, q) && fn(rec, arg) != 0)
+      *stop = 1;
+
+    off += sizeof(*rec) + rec->size;
+  }
+
+  return off;
+}
+
+static int query_segment(const char *seg_path, const char *idx_path, const store_query_t *q, store_visit_fn fn,
+                         void *arg)
+{
+  int stop   = 0;
+  int seg_fd = -1;
+  int idx_fd = -1;
+  char *seg  = MAP_FAILED;
+  char *idx  = MAP_FAILED;
+  struct stat seg_st;
+  struct stat idx_st;
+
+  seg_fd = open(seg_path, O_RDONLY | O_CLOEXEC);
+  if (seg_fd < 0 || fstat(seg_fd, &seg_st) < 0 || (size_t)seg_st.st_size <= sizeof(store_file_hdr_t))
+    goto end;
+
+  seg = mmap(NULL, seg_st.st_size, PROT_READ, MAP_SHARED, seg_fd, 0);
+  if (seg == MAP_FAILED)
+    goto end;
+
+  // only the blocks selected by the index get paged in
+  madvise(seg, seg_st.st_size, MADV_RANDOM);
+
+  uint64_t seg_size = seg_st.st_size;
+  uint64_t covered  = sizeof(store_file_hdr_t);
+
+  idx_fd = open(idx_path, O_RDONLY | O_CLOEXEC);
+  if (idx_fd >= 0 && fstat(idx_fd, &idx_st) == 0 && (size_t)idx_st.st_size > sizeof(store_file_hdr_t))
+  {
+    idx = mmap(NULL, idx_st.st_size, PROT_READ, MAP_SHARED, idx_fd, 0);
+  }
+
+  if (idx != MAP_FAILED)
+  {
+    const store_index_t *entries = (const store_index_t *)(idx + sizeof(store_file_hdr_t));
+    size_t count                 = (idx_st.st_size - sizeof(store_file_hdr_t)) / sizeof(store_index_t);
+
+    for (size_t i = 0; i < count && !stop; i++)
+    {
+      const store_index_t *b = &entries[i];
+      uint64_t end           = b->offset + b->length;
+      if (end > seg_size)
+        end = seg_size;
+      if (end > covered)
+        covered = end;
+
+      if (!block_match(b, q))
+        continue;
+
+      madvise(seg + (b->offset & ~4095ull), end - (b->offset & ~4095ull), MADV_WILLNEED);
+      scan_range(seg, b->offset, end, q, fn, arg, &stop);
+    }
+  }
+
+  // records that never made it into the index
+  if (!stop && covered < seg_size)
+  {
+    scan_range(seg, covered, seg_size, q, fn, arg, &stop);
+  }
+
+end:
+  if (idx != MAP_FAILED)
+    munmap(idx, idx_st.st_size);
+  if (seg != MAP_FAILED)
+    munmap(seg, seg_st.st_size);
+  if (idx_fd >= 0)
+    close(idx_fd);
+  if (seg_fd >= 0)
+    close(seg_fd);
+  return stop;
+}
+
+int store_query(const char *dir, const store_query_t *q, store_visit_fn fn, void *arg)
+{
+  struct dirent **list;
+  int n = scandir(dir, &list, seg_filter, alphasort);
+  if (n < 0)
+    return -1;
+
+  int stop = 0;
+  for (int i = 0; i < n; i++)
+  {
+    char seg_path[PATH_MAX];
+    char idx_path[PATH_MAX];
+    snprintf(seg_path, sizeof(seg_path), "%s/%s", dir, list[i]->d_name);
+    snprintf(idx_path, sizeof(idx_path), "%s/%.*s.idx", dir, (int)strlen(list[i]->d_name) - 4, list[i]->d_name);
+
+    if (!stop)
+      stop = query_segment(seg_path, idx_path, q, fn, arg);
+    free(list[i]);
+  }
+  free(list);
+
+  return 0;
+}
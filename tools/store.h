@@ -0,0 +1,82 @@
+/*
+CatLog
+Copyright (C) 2024 Cat
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef STORE_H
+#define STORE_H
+
+#include "catlog_proto.h"
+
+#include <stdint.h>
+
+// Capture store: a directory of append-only segments.
+//
+//   NNNNNNNN.seg  store_file_hdr_t followed by raw records, exactly as received
+//   NNNNNNNN.idx  store_file_hdr_t followed by one store_index_t per sealed block
+//
+// A block covers up to STORE_BLOCK_LEN bytes of a segment. Records written after
+// the last sealed block (e.g. after a crash) are found by scanning the segment tail.
+
+#define STORE_SEG_MAGIC 0x47534C43 // "CLSG"
+#define STORE_IDX_MAGIC 0x58494C43 // "CLIX"
+#define STORE_VERSION 1
+
+#define STORE_BLOCK_LEN (64 * 1024)
+#define STORE_SEGMENT_LEN (256 * 1024 * 1024)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t reserved;
+} store_file_hdr_t;
+
+typedef struct {
+    uint64_t offset;  // of the first record in the segment
+    uint32_t length;
+    uint32_t count;
+    uint64_t time_min;
+    uint64_t time_max;
+    uint64_t pid_bloom;
+    uint32_t sources; // 1 << CATLOG_SOURCE_*
+    uint32_t types;   // 1 << CATLOG_RECORD_*
+} store_index_t;
+
+typedef struct store store_t;
+
+store_t *store_open(const char *dir);
+int store_append(store_t *st, const CatLogRecord_t *rec);
+int store_flush(store_t *st);
+void store_close(store_t *st);
+
+typedef struct {
+    uint64_t time_min;
+    uint64_t time_max;
+    int64_t pid;      // -1 for any
+    uint32_t sources; // 0 for any
+    uint32_t types;   // 0 for any
+} store_query_t;
+
+// rec points at the header, payload follows it
+typedef int (*store_visit_fn)(const CatLogRecord_t *rec, void *arg);
+
+int store_query(const char *dir, const store_query_t *q, store_visit_fn fn, void *arg);
+
+static inline uint64_t store_pid_bit(uint32_t pid)
+{
+  return 1ull << ((pid * 2654435761u) >> 26);
+}
+
+#endif
@@ -68,6 +68,46 @@ DECL_FUNC_HOOK(sceRegMgrGetKeyInt, const char *category, const char *name, int *
       {
         *value = cfg.net;
       }
+
+      if (sceClibStrncmp(name, "format", 6) == 0)
+      {
+        *value = cfg.format;
+      }
+
+      if (sceClibStrncmp(name, "batch", 5) == 0)
+      {
+        *value = cfg.batch_bytes;
+      }
+
+      if (sceClibStrncmp(name, "flush", 5) == 0)
+      {
+        *value = cfg.flush_ms;
+      }
+
+      if (sceClibStrncmp(name, "priority", 8) == 0)
+      {
+        *value = cfg.net_priority;
+      }
+
+      if (sceClibStrncmp(name, "affinity", 8) == 0)
+      {
+        *value = cfg.net_affinity;
+      }
+
+      if (sceClibStrncmp(name, "minlevel", 8) == 0)
+      {
+        *value = cfg.min_level;
+      }
+
+      if (sceClibStrncmp(name, "caller", 6) == 0)
+      {
+        *value = cfg.caller;
+      }
+
+      if (sceClibStrncmp(name, "metrics", 7) == 0)
+      {
+        *value = cfg.metrics_ms;
+      }
     }
     return 0;
   }
@@ -110,7 +150,47 @@ DECL_FUNC_HOOK(sceRegMgrSetKeyInt, const char *category, const char *name, int v
       cfg.net = value;
     }
 
-    CatLogUpdateConfig(cfg.host, cfg.port, cfg.loglevel, cfg.net);
+    if (sceClibStrncmp(name, "format", 6) == 0)
+    {
+      cfg.format = value;
+    }
+
+    if (sceClibStrncmp(name, "batch", 5) == 0)
+    {
+      cfg.batch_bytes = value;
+    }
+
+    if (sceClibStrncmp(name, "flush", 5) == 0)
+    {
+      cfg.flush_ms = value;
+    }
+
+    if (sceClibStrncmp(name, "priority", 8) == 0)
+    {
+      cfg.net_priority = value;
+    }
+
+    if (sceClibStrncmp(name, "affinity", 8) == 0)
+    {
+      cfg.net_affinity = value;
+    }
+
+    if (sceClibStrncmp(name, "minlevel", 8) == 0)
+    {
+      cfg.min_level = value;
+    }
+
+    if (sceClibStrncmp(name, "caller", 6) == 0)
+    {
+      cfg.caller = value;
+    }
+
+    if (sceClibStrncmp(name, "metrics", 7) == 0)
+    {
+      cfg.metrics_ms = value;
+    }
+
+    CatLogSetConfig(&cfg);
 
     return 0;
   }
@@ -126,7 +206,7 @@ DECL_FUNC_HOOK(sceRegMgrSetKeyStr, const char *category, const char *name, char
       sceNetInetPton(SCE_NET_AF_INET, value, &cfg.host);
     }
 
-    CatLogUpdateConfig(cfg.host, cfg.port, cfg.loglevel, cfg.net);
+    CatLogSetConfig(&cfg);
     return 0;
   }
   return TAI_CONTINUE(int, sceRegMgrSetKeyStrHookRef, category, name, value, len);
@@ -209,7 +289,7 @@ int module_start(SceSize argc, const void *args)
       return SCE_KERNEL_START_SUCCESS;
   }
 
-  CatLogReadConfig(&cfg.host, &cfg.port, &cfg.loglevel, &cfg.net);
+  CatLogGetConfig(&cfg);
 
   BIND_FUNC_IMPORT_HOOK(sceKernelLoadStartModule, "SceSettings", 0xCAE9ACE6, 0x2DCC4AFA);
   BIND_FUNC_IMPORT_HOOK(sceKernelStopUnloadModule, "SceSettings", 0xCAE9ACE6, 0x2415F8A4);